@@ -0,0 +1,151 @@
+#include "analysis.h"
+#include <algorithm>
+#include <cmath>
+
+void bandDownscaler::begin(const unsigned int _width, const unsigned int _height, const int _channels, const unsigned int maxWidth, const unsigned int maxHeight) {
+    this->width = _width;
+    this->height = _height;
+    this->channels = _channels;
+    this->sourceRow = 0;
+    this->outputRow = 0;
+
+    downscaledSize(this->width, this->height, maxWidth, maxHeight, &this->out.width, &this->out.height);
+    this->out.pixels.assign((size_t)this->out.width * this->out.height * 4, 0);
+    this->sums.assign((size_t)this->out.width * this->channels, 0);
+
+    // the same column ranges "image::downscale" averages over
+    this->columnOf.resize(this->width);
+    this->columnStart.resize(this->out.width + 1);
+    for (unsigned int x = 0; x < this->out.width; x++) {
+        unsigned int x0 = (unsigned int)(x * (uint64_t)this->width / this->out.width);
+        unsigned int x1 = std::max(x0 + 1, (unsigned int)((x + 1) * (uint64_t)this->width / this->out.width));
+        this->columnStart[x] = x0;
+        for (unsigned int sx = x0; sx < x1; sx++)
+            this->columnOf[sx] = x;
+    }
+    this->columnStart[this->out.width] = this->width;
+}
+
+unsigned int bandDownscaler::rowEnd(const unsigned int row) const {
+    unsigned int y0 = (unsigned int)(row * (uint64_t)this->height / this->out.height);
+    return std::max(y0 + 1, (unsigned int)((row + 1) * (uint64_t)this->height / this->out.height));
+}
+
+void bandDownscaler::addRow(const uint8_t* row) {
+    for (unsigned int x = 0; x < this->width; x++, row += this->channels) {
+        uint64_t* sum = &this->sums[(size_t)this->columnOf[x] * this->channels];
+        for (int c = 0; c < this->channels; c++)
+            sum[c] += row[c];
+    }
+
+    if (++this->sourceRow == this->rowEnd(this->outputRow))
+        this->finishRow();
+}
+
+void bandDownscaler::finishRow() {
+    unsigned int y0 = (unsigned int)(this->outputRow * (uint64_t)this->height / this->out.height);
+    unsigned int rows = this->rowEnd(this->outputRow) - y0;
+
+    for (unsigned int x = 0; x < this->out.width; x++) {
+        const uint64_t* sum = &this->sums[(size_t)x * this->channels];
+        uint64_t count = (uint64_t)rows * (this->columnStart[x + 1] - this->columnStart[x]);
+        uint8_t* dst = &this->out.pixels[((size_t)this->outputRow * this->out.width + x) * 4];
+        if (this->channels < 3) { // grey (and grey + alpha) is spread across all three colour channels
+            dst[0] = dst[1] = dst[2] = (uint8_t)(sum[0] / count);
+            dst[3] = this->channels == 2 ? (uint8_t)(sum[1] / count) : 255;
+        }
+        else {
+            dst[0] = (uint8_t)(sum[0] / count);
+            dst[1] = (uint8_t)(sum[1] / count);
+            dst[2] = (uint8_t)(sum[2] / count);
+            dst[3] = this->channels == 4 ? (uint8_t)(sum[3] / count) : 255;
+        }
+    }
+
+    std::fill(this->sums.begin(), this->sums.end(), 0);
+    this->outputRow++;
+}
+
+void bandAnalyser::begin(const int _width, const int _height, const int _channels) {
+    this->width = _width;
+    this->height = _height;
+    this->channels = _channels;
+    this->pixels = 0;
+    this->hueHistogram.assign(360 * HUE_BINS_PER_DEGREE, 0);
+    this->features = featureAccumulator();
+    this->thumbnail.begin(this->width, this->height, this->channels, THUMBNAIL_WIDTH, THUMBNAIL_HEIGHT);
+    this->preview.begin(this->width, this->height, this->channels, PREVIEW_WIDTH, PREVIEW_HEIGHT);
+}
+
+void bandAnalyser::addRows(const uint8_t* rows, const int count) {
+    const size_t stride = (size_t)this->width * this->channels;
+    for (int y = 0; y < count; y++) {
+        const uint8_t* row = rows + y * stride;
+
+        // transparent pixels aren't counted, so "pixels" is only the ones the median is taken over
+        forEachTile(this->channels, row, this->width, [this](const pixelTile& tile, size_t count, bool alpha) {
+            for (size_t i = 0; i < count; i++) {
+                if (alpha && tile.planes[3][i] == 0)
+                    continue;
+                this->hueHistogram[std::min((size_t)(tile.hues[i] * HUE_BINS_PER_DEGREE), this->hueHistogram.size() - 1)]++;
+                this->pixels++;
+            }
+            this->features.add(tile, count, alpha);
+        });
+
+        this->thumbnail.addRow(row);
+        this->preview.addRow(row);
+    }
+}
+
+// the middle of the histogram, averaged across the two middle pixels when there's an even number, like "calculateMedianHue"
+double bandAnalyser::getMedianHue() const {
+    if (this->pixels == 0)
+        return 0;
+
+    const uint64_t lower = (this->pixels - 1) / 2, upper = this->pixels / 2;
+    double lowerHue = 0;
+    uint64_t seen = 0;
+    for (size_t bin = 0; bin < this->hueHistogram.size(); bin++) {
+        uint64_t before = seen;
+        seen += this->hueHistogram[bin];
+        double hue = bin == 0 ? 0 : (bin + 0.5) / HUE_BINS_PER_DEGREE; // the first bin is mostly greys, which are exactly 0
+        if (before <= lower && lower < seen)
+            lowerHue = hue;
+        if (before <= upper && upper < seen)
+            return (lowerHue + hue) / 2;
+    }
+    return 0;
+}
+
+void ycbcrPreviews::begin(const int _width, const int _height, const int _channels) {
+    this->width = _width;
+    this->height = _height;
+    this->channels = _channels;
+    this->thumbnail.begin(this->width, this->height, this->channels, THUMBNAIL_WIDTH, THUMBNAIL_HEIGHT);
+    this->preview.begin(this->width, this->height, this->channels, PREVIEW_WIDTH, PREVIEW_HEIGHT);
+}
+
+void ycbcrPreviews::addRows(const uint8_t* rows, const int count) {
+    const size_t stride = (size_t)this->width * this->channels;
+    for (int y = 0; y < count; y++) {
+        this->thumbnail.addRow(rows + y * stride);
+        this->preview.addRow(rows + y * stride);
+    }
+}
+
+// the JFIF conversion libjpeg uses, on the averaged samples; grey is already spread across the three channels by the downscaler
+std::shared_ptr<const bitmap> ycbcrPreviews::toRgb(const bandDownscaler& downscaled) const {
+    std::shared_ptr<const bitmap> averaged = downscaled.getBitmap();
+    if (this->channels < 3)
+        return averaged;
+
+    bitmap converted = *averaged;
+    for (size_t i = 0; i < converted.pixels.size(); i += 4) {
+        double y = converted.pixels[i], cb = converted.pixels[i + 1] - 128.0, cr = converted.pixels[i + 2] - 128.0;
+        converted.pixels[i] = (uint8_t)std::clamp(std::lround(y + 1.402 * cr), 0L, 255L);
+        converted.pixels[i + 1] = (uint8_t)std::clamp(std::lround(y - 0.344136 * cb - 0.714136 * cr), 0L, 255L);
+        converted.pixels[i + 2] = (uint8_t)std::clamp(std::lround(y + 1.772 * cb), 0L, 255L);
+    }
+    return std::make_shared<const bitmap>(std::move(converted));
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "decoder.h"
+#include "image.h"
+
+// hue histogram bins per degree, so a median from it is within 0.005 degrees of the exact one
+#define HUE_BINS_PER_DEGREE 100
+
+/* The same box filter as "image::downscale", built up a band of source rows at a time
+ * Every source row belongs to exactly one output row (there's never any upscaling), so an output row is finished as soon as its last source row arrives
+ */
+class bandDownscaler
+{
+private:
+	unsigned int width = 0;
+	unsigned int height = 0;
+	int channels = 0;
+	std::vector<unsigned int> columnOf; // the output column each source column is averaged into
+	std::vector<unsigned int> columnStart; // the first source column of each output column, plus one past the end
+	std::vector<uint64_t> sums; // for the output row being built
+	unsigned int sourceRow = 0;
+	unsigned int outputRow = 0;
+	bitmap out = { std::vector<uint8_t>(), 0, 0 };
+
+	[[nodiscard]] unsigned int rowEnd(unsigned int row) const;
+	void finishRow();
+public:
+	void begin(unsigned int _width, unsigned int _height, int _channels, unsigned int maxWidth, unsigned int maxHeight);
+	void addRow(const uint8_t* row);
+	[[nodiscard]] std::shared_ptr<const bitmap> getBitmap() const { return std::make_shared<const bitmap>(out); }
+};
+
+/* Everything "loadImageData" needs from an image, worked out from bands of rows as a streaming decoder produces them
+ * Each band goes into the hue histogram, the features and both downscalers and is then dropped, so the full image is never held
+ */
+class bandAnalyser : public bandSink
+{
+private:
+	int width = 0;
+	int height = 0;
+	int channels = 0;
+	std::vector<uint32_t> hueHistogram;
+	uint64_t pixels = 0;
+	bandDownscaler thumbnail;
+	bandDownscaler preview;
+	featureAccumulator features;
+public:
+	void begin(int _width, int _height, int _channels) override;
+	void addRows(const uint8_t* rows, int count) override;
+	[[nodiscard]] int getWidth() const { return width; }
+	[[nodiscard]] int getHeight() const { return height; }
+	[[nodiscard]] int getChannels() const { return channels; }
+	[[nodiscard]] double getMedianHue() const;
+	[[nodiscard]] imageFeatures getFeatures() const { return features.finish(); }
+	[[nodiscard]] std::shared_ptr<const bitmap> getThumbnail() const { return thumbnail.getBitmap(); }
+	[[nodiscard]] std::shared_ptr<const bitmap> getPreview() const { return preview.getBitmap(); }
+};
+
+/* The thumbnail and preview of a JPEG made from its Y, Cb and Cr planes as "jpegChromaMedianHue" reads them, so it's never converted to RGB at full size
+ * The rows are averaged as Y, Cb, Cr and only the averages are converted; the conversion is linear, so that's the same as averaging converted pixels except where RGB would have been clipped
+ */
+class ycbcrPreviews : public bandSink
+{
+private:
+	int width = 0;
+	int height = 0;
+	int channels = 0;
+	bandDownscaler thumbnail;
+	bandDownscaler preview;
+
+	[[nodiscard]] std::shared_ptr<const bitmap> toRgb(const bandDownscaler& downscaled) const;
+public:
+	void begin(int _width, int _height, int _channels) override;
+	void addRows(const uint8_t* rows, int count) override;
+	[[nodiscard]] int getWidth() const { return width; }
+	[[nodiscard]] int getHeight() const { return height; }
+	[[nodiscard]] int getChannels() const { return channels; }
+	[[nodiscard]] std::shared_ptr<const bitmap> getThumbnail() const { return toRgb(thumbnail); }
+	[[nodiscard]] std::shared_ptr<const bitmap> getPreview() const { return toRgb(preview); }
+};
@@ -0,0 +1,416 @@
+#include "benchmark.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <SFML/OpenGL.hpp>
+#include "viewer.h"
+#include "analysis.h"
+#include "decoder.h"
+#include "exif.h"
+#include "hue.h"
+#include "image.h"
+#include "io.h"
+#include "oklab.h"
+#include "scanner.h"
+
+// files of each format decoded by the decoder benchmark, and how many times each is decoded by each backend
+#define DECODER_BENCHMARK_FILES 16
+#define DECODER_BENCHMARK_ROUNDS 3
+
+typedef struct {
+	std::string name;
+	std::vector<sf::Keyboard::Key> keys;
+} keyScript;
+
+typedef struct {
+	std::string name;
+	std::vector<double> microseconds;
+} benchmarkSamples;
+
+/* Draws a frame and waits until the GPU has actually finished it
+ * "display" on a render texture only flushes, so without "glFinish" we'd be timing how fast commands are queued rather than how long a frame takes
+ */
+static double timeFrame(viewer& view, sf::RenderTexture& target) {
+    auto start = std::chrono::steady_clock::now();
+    view.draw(target);
+    target.display();
+    glFinish();
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void printPercentiles(const benchmarkSamples& samples) {
+    if (samples.microseconds.empty())
+        return;
+
+    std::vector<double> sorted = samples.microseconds;
+    std::sort(sorted.begin(), sorted.end());
+    auto percentile = [&sorted](double p) { return sorted[std::min(sorted.size() - 1, (size_t)(p * sorted.size()))] / 1000.0; };
+
+    std::cout << samples.name << " (" << sorted.size() << " samples): p50 " << percentile(0.5) << "ms, p90 " << percentile(0.9) << "ms, p99 " << percentile(0.99) << "ms, max " << sorted.back() / 1000.0 << "ms" << std::endl;
+}
+
+/* Drives the viewer with scripted key presses and renders offscreen, so UI changes can be measured on a headless box (e.g. "xvfb-run ./cw1 --benchmark-ui")
+ * Keypress-to-present latency is the time from handing the viewer a key to the finished frame, which includes any texture loads the key causes
+ * Frame times are measured separately, as plain redraws with nothing changed
+ */
+int benchmarkUI(std::shared_ptr<catalog> cat, std::shared_ptr<thumbnailStore> store, std::shared_ptr<memoryBudget> budget, const std::string& placeholderPath) {
+    std::cout << "UI benchmark started" << std::endl;
+
+    sf::RenderTexture target;
+    if (!target.create(viewer::WIDTH, viewer::HEIGHT)) {
+        std::cout << "(!) failed to create the offscreen render target" << std::endl;
+        return EXIT_FAILURE;
+    }
+    target.setActive(true);
+
+    viewer view(cat, store, budget, placeholderPath);
+    view.refresh();
+    if (!view.isShowingImage()) {
+        std::cout << "(!) there are no images to benchmark with" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::vector<keyScript> scripts;
+    scripts.push_back({ "browse forward", std::vector<sf::Keyboard::Key>(200, sf::Keyboard::Key::Right) });
+    scripts.push_back({ "browse back", std::vector<sf::Keyboard::Key>(200, sf::Keyboard::Key::Left) });
+    keyScript grid = { "grid", { sf::Keyboard::Key::G } };
+    for (int row = 0; row < 20; row++) {
+        grid.keys.insert(grid.keys.end(), viewer::GRID_COLUMNS - 1, sf::Keyboard::Key::Right);
+        grid.keys.push_back(sf::Keyboard::Key::Down);
+    }
+    grid.keys.push_back(sf::Keyboard::Key::Enter);
+    scripts.push_back(grid);
+    // round the sort keys 20 times; the image shown doesn't change, so this is only the cost of the switch and a redraw
+    scripts.push_back({ "switch sort key", std::vector<sf::Keyboard::Key>(SORT_KEYS * 20, sf::Keyboard::Key::O) });
+
+    std::vector<benchmarkSamples> results;
+
+    for (keyScript& script : scripts) {
+        benchmarkSamples latency = { "keypress-to-present, " + script.name, {} };
+        for (sf::Keyboard::Key key : script.keys) {
+            auto start = std::chrono::steady_clock::now();
+            view.handleKey(key);
+            view.draw(target);
+            target.display();
+            glFinish();
+            latency.microseconds.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+        }
+        results.push_back(latency);
+    }
+
+    benchmarkSamples redraw = { "frame time, redraw", {} };
+    for (int i = 0; i < 200; i++) {
+        view.invalidate();
+        redraw.microseconds.push_back(timeFrame(view, target));
+    }
+    results.push_back(redraw);
+
+    std::ofstream csv;
+    csv.open("ui_benchmark.csv");
+    if (csv.is_open()) {
+        for (benchmarkSamples& samples : results)
+            for (size_t i = 0; i < samples.microseconds.size(); i++)
+                csv << samples.name << ',' << i + 1 << ',' << samples.microseconds[i] << '\n';
+        csv.close();
+    }
+    else
+        std::cout << "(!) failed to open/create CSV file" << std::endl;
+
+    for (benchmarkSamples& samples : results)
+        printPercentiles(samples);
+
+    return EXIT_SUCCESS;
+}
+
+// how far apart two hues are around the colour wheel, in degrees
+static double hueDistance(const double a, const double b) {
+    double distance = std::fabs(a - b);
+    return std::min(distance, 360.0 - distance);
+}
+
+#ifdef HAVE_LIBJPEG
+/* Compares "--chroma-hue"'s median against the usual one from RGB, on the same JPEGs
+ * Each side is timed for everything "loadImageData" does to get an image's hue and previews: a full decode, the previews and the hue from every pixel, against the one raw pass and the features from its preview
+ */
+static void reportChromaHue(const std::vector<std::vector<uint8_t>>& files) {
+    std::vector<double> differences;
+    double chromaSeconds = 0, rgbSeconds = 0;
+
+    for (const std::vector<uint8_t>& file : files) {
+        std::string error;
+        auto start = std::chrono::steady_clock::now();
+        decodedImage decoded;
+        if (!decoders().decode(file.data(), file.size(), decoded, &error))
+            continue;
+        image img("", std::move(decoded.pixels), decoded.width, decoded.height, decoded.channels);
+        img.generatePreviews();
+        img.calculateMedianHue();
+        auto stop = std::chrono::steady_clock::now();
+        const double rgb = std::chrono::duration<double>(stop - start).count();
+
+        start = std::chrono::steady_clock::now();
+        double chromaMedian;
+        ycbcrPreviews previews;
+        if (!jpegChromaMedianHue(file.data(), file.size(), &chromaMedian, &previews, &error))
+            continue;
+        image chroma("", pixelBuffer(), previews.getWidth(), previews.getHeight(), previews.getChannels());
+        chroma.setPreviews(previews.getThumbnail(), previews.getPreview());
+        chroma.estimateFeatures();
+        stop = std::chrono::steady_clock::now();
+        chromaSeconds += std::chrono::duration<double>(stop - start).count();
+        rgbSeconds += rgb;
+
+        differences.push_back(hueDistance(chromaMedian, img.getHueDegrees()));
+    }
+
+    if (differences.empty())
+        return;
+
+    std::sort(differences.begin(), differences.end());
+    double mean = 0;
+    for (double difference : differences)
+        mean += difference / differences.size();
+    size_t withinOne = std::upper_bound(differences.begin(), differences.end(), 1.0) - differences.begin();
+
+    std::cout << "jpeg, hue from chroma vs RGB (" << differences.size() << " files): mean difference " << mean << " degrees, max " << differences.back() << ", " << withinOne << " within 1 degree; "
+        << chromaSeconds * 1000 / differences.size() << "ms per image vs " << rgbSeconds * 1000 / differences.size() << "ms, decode and previews included for both" << std::endl;
+}
+#endif
+
+// each value's position once sorted, with ties given the average of the positions they span
+static std::vector<double> ranks(const std::vector<double>& values) {
+    std::vector<size_t> order(values.size());
+    for (size_t i = 0; i < order.size(); i++)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [&values](size_t a, size_t b) { return values[a] < values[b]; });
+
+    std::vector<double> ranked(values.size());
+    for (size_t i = 0; i < order.size();) {
+        size_t j = i;
+        while (j + 1 < order.size() && values[order[j + 1]] == values[order[i]])
+            j++;
+        for (size_t k = i; k <= j; k++)
+            ranked[order[k]] = (i + j) / 2.0;
+        i = j + 1;
+    }
+    return ranked;
+}
+
+// Spearman's rank correlation, 1 when both put the images in exactly the same order
+static double rankCorrelation(const std::vector<double>& a, const std::vector<double>& b) {
+    std::vector<double> rankA = ranks(a), rankB = ranks(b);
+    double meanRank = (a.size() - 1) / 2.0;
+    double covariance = 0, varianceA = 0, varianceB = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        covariance += (rankA[i] - meanRank) * (rankB[i] - meanRank);
+        varianceA += (rankA[i] - meanRank) * (rankA[i] - meanRank);
+        varianceB += (rankB[i] - meanRank) * (rankB[i] - meanRank);
+    }
+    return varianceA > 0 && varianceB > 0 ? covariance / std::sqrt(varianceA * varianceB) : 1.0;
+}
+
+/* Compares "--exif-thumbnails"' hues against those from decoding the whole photo, on the same JPEGs
+ * What matters for sorting is the order, so this reports the rank correlation as well as how far the hues are apart
+ */
+static void reportExifHue(const std::vector<std::vector<uint8_t>>& files) {
+    std::vector<double> thumbnailHues, fullHues, differences;
+    double thumbnailSeconds = 0, fullSeconds = 0;
+    size_t withoutThumbnail = 0;
+
+    for (const std::vector<uint8_t>& file : files) {
+        const uint8_t* thumbnailData;
+        size_t thumbnailSize;
+        decodedImage thumbnail, full;
+        std::string error;
+
+        auto start = std::chrono::steady_clock::now();
+        if (!findExifThumbnail(file.data(), file.size(), &thumbnailData, &thumbnailSize) || !decoders().decode(thumbnailData, thumbnailSize, thumbnail, &error)) {
+            withoutThumbnail++;
+            continue;
+        }
+        image small("", std::move(thumbnail.pixels), thumbnail.width, thumbnail.height, thumbnail.channels);
+        small.calculateMedianHue();
+        auto stop = std::chrono::steady_clock::now();
+        thumbnailSeconds += std::chrono::duration<double>(stop - start).count();
+
+        start = std::chrono::steady_clock::now();
+        if (!decoders().decode(file.data(), file.size(), full, &error))
+            continue;
+        image big("", std::move(full.pixels), full.width, full.height, full.channels);
+        big.calculateMedianHue();
+        stop = std::chrono::steady_clock::now();
+        fullSeconds += std::chrono::duration<double>(stop - start).count();
+
+        thumbnailHues.push_back(small.getHueDegrees());
+        fullHues.push_back(big.getHueDegrees());
+        differences.push_back(hueDistance(small.getHueDegrees(), big.getHueDegrees()));
+    }
+
+    std::cout << "jpeg, hue from EXIF thumbnails: " << withoutThumbnail << " of " << files.size() << " files had none";
+    if (differences.empty()) {
+        std::cout << std::endl;
+        return;
+    }
+
+    double mean = 0;
+    for (double difference : differences)
+        mean += difference / differences.size();
+    std::cout << "; rank correlation with full decoding " << rankCorrelation(thumbnailHues, fullHues) << ", mean difference " << mean << " degrees, max " << *std::max_element(differences.begin(), differences.end())
+        << "; " << thumbnailSeconds * 1000 / differences.size() << "ms per image vs " << fullSeconds * 1000 / differences.size() << "ms decoding in full" << std::endl;
+}
+
+/* Times the OKLab ordering against the HSV median hue on the same decoded pixels, and checks the fast conversion against the exact one
+ * Both go through "forEachTile", so the deinterleaving and the HSV hues are in both times and the difference is the OKLab conversion and its histograms
+ * The HSV side is only the hue, without the rest of the features, so the ratio is the worst it could be
+ */
+static void reportPerceptualOrder(const std::map<imageFormat, std::vector<std::vector<uint8_t>>>& samples) {
+    double hsvSeconds = 0, perceptualSeconds = 0, megapixels = 0;
+    std::vector<double> hsvHues, perceptualHues;
+
+    for (const auto& [format, files] : samples) {
+        for (const std::vector<uint8_t>& file : files) {
+            decodedImage decoded;
+            std::string error;
+            if (!decoders().decode(file.data(), file.size(), decoded, &error))
+                continue;
+            const size_t count = (size_t)decoded.width * decoded.height;
+
+            auto start = std::chrono::steady_clock::now();
+            std::vector<float> hues;
+            hues.reserve(count);
+            bool known = forEachHue(decoded.channels, decoded.pixels.data(), count, [&hues](float hue) { hues.push_back(hue); });
+            if (!known || hues.empty())
+                continue;
+            std::nth_element(hues.begin(), hues.begin() + hues.size() / 2, hues.end());
+            auto stop = std::chrono::steady_clock::now();
+            hsvSeconds += std::chrono::duration<double>(stop - start).count();
+
+            start = std::chrono::steady_clock::now();
+            perceptualAccumulator accumulator;
+            forEachTile(decoded.channels, decoded.pixels.data(), count, [&accumulator](const pixelTile& tile, size_t n, bool alpha) { accumulator.add(tile, n, alpha); });
+            float hue, lightness;
+            accumulator.finish(&hue, &lightness);
+            stop = std::chrono::steady_clock::now();
+            perceptualSeconds += std::chrono::duration<double>(stop - start).count();
+            megapixels += count / 1e6;
+
+            // only images both say have a hue are compared, the neutral ones aren't in the same place in the two orders
+            if (hue >= 0 && hues[hues.size() / 2] != 0) {
+                hsvHues.push_back(hues[hues.size() / 2]);
+                perceptualHues.push_back(hue);
+            }
+        }
+    }
+    if (hsvSeconds <= 0 || perceptualSeconds <= 0)
+        return;
+
+    // every 15th level of each channel, which takes in both 0 and 255
+    double lightnessError = 0, hueError = 0;
+    pixelTile tile;
+    oklabTile converted;
+    for (int r = 0; r < 256; r += 15) {
+        size_t count = 0;
+        for (int g = 0; g < 256; g += 15)
+            for (int b = 0; b < 256; b += 15, count++) {
+                tile.planes[0][count] = (uint8_t)r;
+                tile.planes[1][count] = (uint8_t)g;
+                tile.planes[2][count] = (uint8_t)b;
+            }
+        planarOklab(tile, count, converted);
+        for (size_t i = 0; i < count; i++) {
+            double exact[3];
+            oklabReference(tile.planes[0][i], tile.planes[1][i], tile.planes[2][i], exact);
+            lightnessError = std::max(lightnessError, fabs(exact[0] - converted.lightness[i]));
+            if (exact[1] >= OKLAB_NEUTRAL_CHROMA)
+                hueError = std::max(hueError, hueDistance(exact[2], converted.hues[i]));
+        }
+    }
+
+    std::cout << "OKLab order: " << megapixels / perceptualSeconds << " megapixels/s vs " << megapixels / hsvSeconds << " for the HSV median hue (" << perceptualSeconds / hsvSeconds << "x the time)";
+    if (hsvHues.size() > 1)
+        std::cout << ", rank correlation with HSV " << rankCorrelation(hsvHues, perceptualHues) << " over " << hsvHues.size() << " coloured images";
+    std::cout << "; fast conversion off by at most " << lightnessError << " in L and " << hueError << " degrees" << std::endl;
+}
+
+/* Times every backend on the same files of each format, and keeps the results for "decoderRegistry::loadThroughput" to choose from on later runs
+ * Files are read into memory first so only decoding is timed, and every backend gets one untimed pass so they all start with warm caches
+ */
+int benchmarkDecoders(const std::vector<std::string>& roots) {
+    std::cout << "Decoder benchmark started" << std::endl;
+
+    std::map<imageFormat, std::vector<std::vector<uint8_t>>> samples;
+    directoryScanner scanner([&samples](const std::string& path, uint64_t) {
+        std::vector<uint8_t> data;
+        if (!readFile(path, data))
+            return;
+
+        std::vector<std::vector<uint8_t>>& files = samples[detectFormat(data.data(), data.size())];
+        if (files.size() < DECODER_BENCHMARK_FILES)
+            files.push_back(std::move(data));
+    });
+    scanner.scan(roots, 1); // one thread, so "samples" isn't shared
+
+    std::ofstream csv;
+    csv.open(DECODER_BENCHMARK);
+    if (!csv.is_open()) {
+        std::cout << "(!) failed to open/create CSV file" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    for (auto& [format, files] : samples) {
+        for (const std::unique_ptr<imageDecoder>& backend : decoders().getBackends()) {
+            if (!backend->supports(format))
+                continue;
+
+            double megapixels = 0;
+            double seconds = 0;
+            size_t failures = 0;
+            for (int round = 0; round <= DECODER_BENCHMARK_ROUNDS; round++) {
+                for (const std::vector<uint8_t>& file : files) {
+                    decodedImage decoded;
+                    std::string error;
+
+                    auto start = std::chrono::steady_clock::now();
+                    bool decodedFile = backend->decode(file.data(), file.size(), decoded, &error);
+                    auto stop = std::chrono::steady_clock::now();
+
+                    if (round == 0) { // the warm-up
+                        failures += decodedFile ? 0 : 1;
+                        continue;
+                    }
+                    if (decodedFile) {
+                        megapixels += (double)decoded.width * decoded.height / 1e6;
+                        seconds += std::chrono::duration<double>(stop - start).count();
+                    }
+                }
+            }
+
+            if (seconds <= 0) {
+                std::cout << formatName(format) << ", " << backend->getName() << ": couldn't decode any of the " << files.size() << " files" << std::endl;
+                continue;
+            }
+
+            std::cout << formatName(format) << ", " << backend->getName() << ": " << megapixels / seconds << " megapixels/s (" << files.size() << " files, " << failures << " failed)" << std::endl;
+            csv << formatName(format) << ',' << backend->getName() << ',' << megapixels / seconds << '\n';
+        }
+    }
+    csv.close();
+
+    if (samples.count(imageFormat::jpeg))
+        reportExifHue(samples[imageFormat::jpeg]);
+#ifdef HAVE_LIBJPEG
+    if (samples.count(imageFormat::jpeg))
+        reportChromaHue(samples[imageFormat::jpeg]);
+#endif
+
+    reportPerceptualOrder(samples);
+
+    decoders().loadThroughput(DECODER_BENCHMARK);
+    for (auto& [format, files] : samples)
+        std::cout << formatName(format) << " will be decoded by " << decoders().decoderFor(format).getName() << std::endl;
+
+    return EXIT_SUCCESS;
+}
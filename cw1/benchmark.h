@@ -0,0 +1,10 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <vector>
+#include "budget.h"
+#include "catalog.h"
+#include "thumbnails.h"
+
+int benchmarkUI(std::shared_ptr<catalog> cat, std::shared_ptr<thumbnailStore> store, std::shared_ptr<memoryBudget> budget, const std::string& placeholderPath);
+int benchmarkDecoders(const std::vector<std::string>& roots);
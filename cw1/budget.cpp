@@ -0,0 +1,52 @@
+#include "budget.h"
+#include <algorithm>
+
+/* "callback" is told how much of the limit is free each time that changes, so memory outside the reservations (the buffer pool's cache) can be kept to it
+ * It's called with the budget's lock held, so the calls arrive in order and it mustn't use the budget itself
+ */
+void memoryBudget::setHeadroomCallback(std::function<void(uint64_t headroom)> callback) {
+    std::lock_guard<std::mutex> lock(mut);
+    this->headroomChanged = callback;
+    this->headroomChangedLocked();
+}
+
+void memoryBudget::headroomChangedLocked() {
+    if (this->headroomChanged)
+        this->headroomChanged(this->used < this->limit ? this->limit - this->used : 0);
+}
+
+void memoryBudget::acquire(const uint64_t bytes) {
+    std::unique_lock<std::mutex> lock(mut);
+    this->released.wait(lock, [this, bytes]() { return this->used == 0 || this->used + bytes <= this->limit; });
+
+    this->used += bytes;
+    this->peak = std::max(this->peak, this->used);
+    this->headroomChangedLocked();
+}
+
+// the same without waiting: false, with nothing reserved, if it doesn't fit right now
+bool memoryBudget::tryAcquire(const uint64_t bytes) {
+    std::lock_guard<std::mutex> lock(mut);
+    if (this->used != 0 && this->used + bytes > this->limit)
+        return false;
+
+    this->used += bytes;
+    this->peak = std::max(this->peak, this->used);
+    this->headroomChangedLocked();
+    return true;
+}
+
+void memoryBudget::release(const uint64_t bytes) {
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        this->used -= bytes;
+        this->headroomChangedLocked();
+    }
+    this->released.notify_all();
+}
+
+// the most that was ever reserved at once, to check the budget is what's actually bounding memory
+uint64_t memoryBudget::getPeak() {
+    std::lock_guard<std::mutex> lock(mut);
+    return this->peak;
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+
+// the default cap on memory held by decoded pixels at once
+#define DECODE_MEMORY_BUDGET (1024ull * 1024 * 1024)
+
+/* A limit on how many bytes of decoded pixels can be alive at once, shared by every thread decoding
+ * A decode reserves what it will need before it starts and blocks while the budget is used up, so a big folder (or a few huge images) can't grow memory without bound
+ * One reservation is always let through when nothing else is held, otherwise an image bigger than the whole budget could never be decoded
+ */
+class memoryBudget
+{
+private:
+	uint64_t limit;
+	uint64_t used = 0;
+	uint64_t peak = 0;
+	std::function<void(uint64_t)> headroomChanged;
+	std::mutex mut;
+	std::condition_variable released;
+
+	void headroomChangedLocked();
+public:
+	memoryBudget(uint64_t _limit) : limit(_limit) {}
+	~memoryBudget() = default;
+	memoryBudget(const memoryBudget&) = delete;
+	memoryBudget& operator=(const memoryBudget&) = delete;
+	void acquire(uint64_t bytes);
+	bool tryAcquire(uint64_t bytes);
+	void release(uint64_t bytes);
+	void setHeadroomCallback(std::function<void(uint64_t headroom)> callback);
+	[[nodiscard]] uint64_t getLimit() const { return limit; }
+	[[nodiscard]] uint64_t getPeak();
+};
@@ -0,0 +1,198 @@
+#include "bufferpool.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+// the size transparent huge pages come in on x86-64 and most ARM64 kernels
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+// never destroyed, as buffers can still be freed into it by threads that outlive "main" (and by other static destructors)
+bufferPool& pixelBuffers() {
+    static bufferPool* pool = new bufferPool();
+    return *pool;
+}
+
+bufferPool::~bufferPool() {
+    for (std::vector<blockHeader*>& blocks : this->freeBlocks)
+        for (blockHeader* header : blocks)
+            this->systemFree(header);
+}
+
+/* Classes go 64KB, 80KB, 96KB, 112KB, 128KB, 160KB, ... i.e. four evenly spaced steps between each power of two
+ * Returns the class's index and sets "capacity" to its size
+ */
+size_t bufferPool::sizeClassOf(const size_t bytes, size_t* capacity) {
+    unsigned int exponent = 16;
+    while (exponent < 63 && ((size_t)1 << (exponent + 1)) <= bytes)
+        exponent++;
+
+    size_t base = (size_t)1 << exponent;
+    size_t step = base / 4;
+    size_t quarter = bytes <= base ? 0 : (bytes - base + step - 1) / step;
+    if (quarter == 4) {
+        exponent++;
+        base <<= 1;
+        quarter = 0;
+    }
+
+    *capacity = base + quarter * (base / 4);
+    return (exponent - 16) * 4 + quarter;
+}
+
+bufferPool::blockHeader* bufferPool::systemAllocate(const size_t sizeClass, const size_t capacity) {
+    size_t mappedBytes = capacity + sizeof(blockHeader);
+    void* memory;
+
+#ifdef __linux__
+    // huge pages only help a block that spans at least one, and the mapping has to cover whole ones for the kernel to use them
+    bool huge = this->hugePages && mappedBytes >= HUGE_PAGE_SIZE;
+    if (huge)
+        mappedBytes = (mappedBytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+
+    memory = mmap(nullptr, mappedBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+        return nullptr;
+    if (huge)
+        madvise(memory, mappedBytes, MADV_HUGEPAGE);
+#else
+    memory = std::malloc(mappedBytes);
+    if (memory == nullptr)
+        return nullptr;
+#endif
+
+    blockHeader* header = static_cast<blockHeader*>(memory);
+    header->capacity = capacity;
+    header->sizeClass = sizeClass;
+    header->mappedBytes = mappedBytes;
+    return header;
+}
+
+void bufferPool::systemFree(blockHeader* header) {
+#ifdef __linux__
+    munmap(header, header->mappedBytes);
+#else
+    std::free(header);
+#endif
+}
+
+void* bufferPool::allocate(const size_t bytes) {
+    if (bytes < POOL_MIN_BLOCK) {
+        blockHeader* header = static_cast<blockHeader*>(std::malloc(bytes + sizeof(blockHeader)));
+        if (header == nullptr)
+            return nullptr;
+        header->capacity = bytes;
+        header->sizeClass = SMALL_BLOCK;
+        return header + 1;
+    }
+
+    size_t capacity;
+    size_t sizeClass = sizeClassOf(bytes, &capacity);
+
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        this->allocations++;
+
+        if (sizeClass < this->freeBlocks.size() && !this->freeBlocks[sizeClass].empty()) {
+            blockHeader* header = this->freeBlocks[sizeClass].back();
+            this->freeBlocks[sizeClass].pop_back();
+            this->cachedBytes -= header->mappedBytes;
+            return header + 1;
+        }
+
+        this->systemAllocations++;
+    }
+
+    blockHeader* header = this->systemAllocate(sizeClass, capacity);
+    return header == nullptr ? nullptr : header + 1;
+}
+
+// what stb grows its buffers with; a pooled block usually has room to spare, in which case nothing moves
+void* bufferPool::reallocate(void* block, const size_t bytes) {
+    if (block == nullptr)
+        return this->allocate(bytes);
+
+    blockHeader* header = static_cast<blockHeader*>(block) - 1;
+    if (header->sizeClass == SMALL_BLOCK && bytes < POOL_MIN_BLOCK) {
+        header = static_cast<blockHeader*>(std::realloc(header, bytes + sizeof(blockHeader)));
+        if (header == nullptr)
+            return nullptr;
+        header->capacity = bytes;
+        return header + 1;
+    }
+    if (header->sizeClass != SMALL_BLOCK && bytes <= header->capacity)
+        return block;
+
+    void* moved = this->allocate(bytes);
+    if (moved == nullptr)
+        return nullptr;
+    memcpy(moved, block, std::min(bytes, header->capacity));
+    this->free(block);
+    return moved;
+}
+
+void bufferPool::free(void* block) {
+    if (block == nullptr)
+        return;
+
+    blockHeader* header = static_cast<blockHeader*>(block) - 1;
+    if (header->sizeClass == SMALL_BLOCK) {
+        std::free(header);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        if (this->cachedBytes + header->mappedBytes <= this->cacheLimit) {
+            if (header->sizeClass >= this->freeBlocks.size())
+                this->freeBlocks.resize(header->sizeClass + 1);
+            this->freeBlocks[header->sizeClass].push_back(header);
+            this->cachedBytes += header->mappedBytes;
+            return;
+        }
+    }
+
+    this->systemFree(header);
+}
+
+/* Keeps the cache within "bytes" as well as "POOL_CACHE_BYTES", giving back the biggest blocks first if it's over
+ * The memory budget sets this to its headroom whenever that changes, so the reserved pixels and the cached blocks together stay within its limit
+ */
+void bufferPool::setCacheLimit(const uint64_t bytes) {
+    std::vector<blockHeader*> evicted;
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        this->cacheLimit = std::min<uint64_t>(bytes, POOL_CACHE_BYTES);
+        for (size_t sizeClass = this->freeBlocks.size(); sizeClass-- > 0 && this->cachedBytes > this->cacheLimit;) {
+            std::vector<blockHeader*>& blocks = this->freeBlocks[sizeClass];
+            while (!blocks.empty() && this->cachedBytes > this->cacheLimit) {
+                this->cachedBytes -= blocks.back()->mappedBytes;
+                evicted.push_back(blocks.back());
+                blocks.pop_back();
+            }
+        }
+    }
+
+    for (blockHeader* header : evicted)
+        this->systemFree(header);
+}
+
+// only affects blocks allocated from now on, so this should be set before any decoding starts
+void bufferPool::setHugePages(const bool enabled) {
+    std::lock_guard<std::mutex> lock(mut);
+    this->hugePages = enabled;
+}
+
+uint64_t bufferPool::getAllocations() {
+    std::lock_guard<std::mutex> lock(mut);
+    return this->allocations;
+}
+
+uint64_t bufferPool::getSystemAllocations() {
+    std::lock_guard<std::mutex> lock(mut);
+    return this->systemAllocations;
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+// anything smaller than this goes straight to malloc, recycling only pays off for the multi-megabyte pixel buffers
+#define POOL_MIN_BLOCK (64 * 1024)
+// freed blocks kept for reuse, beyond this (or the memory budget's headroom, see "setCacheLimit") they go back to the OS
+#define POOL_CACHE_BYTES (512ull * 1024 * 1024)
+
+/* Recycles large buffers instead of giving them back to the OS as soon as they're freed
+ * Every image decode used to malloc a buffer of several MB in stb and another for the image's own copy, then free both shortly after
+ * Allocations that big are "mmap"ed by malloc, so each one cost a pair of system calls plus a page fault for every 4KB touched
+ * Here a freed block goes onto a free list for its size class and the next image of a similar size takes it, already faulted in
+ * Classes are a quarter of a power of two apart, so a block is never more than 25% bigger than what was asked for
+ * On Linux blocks can also be backed by transparent huge pages, which cuts the faults on a fresh block by 512 times
+ */
+class bufferPool
+{
+private:
+	typedef struct {
+		size_t capacity; // usable bytes after the header
+		size_t sizeClass; // "SMALL_BLOCK" if it came from malloc
+		size_t mappedBytes; // what was asked of the OS, header included
+		size_t padding; // keeps the header a multiple of 16 bytes, so the block after it is at least as aligned as malloc's
+	} blockHeader;
+
+	static constexpr size_t SMALL_BLOCK = SIZE_MAX;
+
+	std::vector<std::vector<blockHeader*>> freeBlocks; // by size class
+	uint64_t cachedBytes = 0;
+	uint64_t cacheLimit = POOL_CACHE_BYTES;
+	uint64_t allocations = 0;
+	uint64_t systemAllocations = 0; // allocations that couldn't be served from a free list
+	bool hugePages = false;
+	std::mutex mut;
+
+	static size_t sizeClassOf(size_t bytes, size_t* capacity);
+	blockHeader* systemAllocate(size_t sizeClass, size_t capacity);
+	void systemFree(blockHeader* header);
+public:
+	bufferPool() = default;
+	~bufferPool();
+	bufferPool(const bufferPool&) = delete;
+	bufferPool& operator=(const bufferPool&) = delete;
+	void* allocate(size_t bytes);
+	void* reallocate(void* block, size_t bytes);
+	void free(void* block);
+	void setHugePages(bool enabled);
+	void setCacheLimit(uint64_t bytes);
+	[[nodiscard]] uint64_t getAllocations();
+	[[nodiscard]] uint64_t getSystemAllocations();
+};
+
+// the one pool every pixel buffer comes from, including stb's (see "STBI_MALLOC" in main.cpp)
+bufferPool& pixelBuffers();
+
+// lets a "std::vector" draw from "pixelBuffers"
+template <typename T>
+struct pooledAllocator
+{
+	typedef T value_type;
+
+	pooledAllocator() = default;
+	template <typename U>
+	pooledAllocator(const pooledAllocator<U>&) {}
+
+	T* allocate(size_t n) { return static_cast<T*>(pixelBuffers().allocate(n * sizeof(T))); }
+	void deallocate(T* p, size_t) { pixelBuffers().free(p); }
+
+	// "resize" leaves new elements uninitialised rather than zeroing them, as a decoder is about to overwrite every byte anyway
+	template <typename U>
+	void construct(U* p) { ::new ((void*)p) U; }
+	template <typename U, typename... Args>
+	void construct(U* p, Args&&... args) { ::new ((void*)p) U(std::forward<Args>(args)...); }
+
+	template <typename U>
+	bool operator==(const pooledAllocator<U>&) const { return true; }
+	template <typename U>
+	bool operator!=(const pooledAllocator<U>&) const { return false; }
+};
+
+typedef std::vector<uint8_t, pooledAllocator<uint8_t>> pixelBuffer;
@@ -0,0 +1,370 @@
+#include "catalog.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <filesystem>
+#include <thread>
+#include "radixsort.h"
+
+namespace fs = std::filesystem;
+
+// a median saturation (0-255) below which an image counts as neutral in the colour order, its hue is mostly noise by then
+#define NEUTRAL_SATURATION 24
+
+std::string sortKeyName(const sortKey key) {
+    switch (key) {
+    case sortKey::hue: return "hue";
+    case sortKey::saturation: return "saturation";
+    case sortKey::brightness: return "brightness";
+    case sortKey::fileSize: return "file size";
+    case sortKey::date: return "date";
+    case sortKey::perceptual: return "perceptual hue";
+    case sortKey::colour: return "colour";
+    }
+    return "";
+}
+
+// whether "entry" has a value for "key" yet, and what it is
+static bool sortValue(const catalogEntry& entry, const sortKey key, double* value) {
+    switch (key) {
+    case sortKey::hue: *value = entry.medianHue; return entry.hueKnown;
+    case sortKey::saturation: *value = entry.features.medianSaturation; return entry.features.known;
+    case sortKey::brightness: *value = entry.features.meanLab[0]; return entry.features.known; // Lab's L* rather than HSV's value, so it's how bright it looks
+    case sortKey::fileSize: *value = (double)entry.fileSize; return true;
+    case sortKey::date: *value = (double)entry.modified; return true;
+    // OKLab's hue angle, with the neutral images after all the coloured ones, darkest first; there's none without "--perceptual-hue"
+    case sortKey::perceptual: *value = entry.features.perceptualHue >= 0 ? entry.features.perceptualHue : 360.0 + entry.features.perceptualLightness; return entry.features.known && entry.features.perceptualLightness >= 0;
+    case sortKey::colour: return false; // several values in one, see "colourKey"
+    }
+    return false;
+}
+
+/* Hue, saturation and value packed into one key, with the path's hash below them for a tie-break that doesn't depend on which image loaded first
+ *   coloured: 0 | hue (16 bits) | saturation (8) | value (8) | path hash (31)
+ *   neutral:  1 | value (8) | saturation (8) | hue (16) | path hash (31)
+ * Neutral images would otherwise all pile up among the reds at hue 0; instead they go after every coloured one, from dark to light
+ */
+uint64_t colourKey(const catalogEntry& entry) {
+    const uint64_t hue = (uint64_t)std::min(65535.0, std::max(0.0, entry.medianHue / 360.0 * 65536.0));
+    const uint64_t saturation = entry.features.medianSaturation, value = entry.features.medianValue;
+    if (entry.features.known && saturation < NEUTRAL_SATURATION)
+        return 1ull << 63 | value << 55 | saturation << 47 | hue << 31 | entry.pathHash;
+    return hue << 47 | saturation << 39 | value << 31 | entry.pathHash;
+}
+
+// whether "entry" has a value for "key" yet, as a key for "radixSort"
+static bool packedKey(const catalogEntry& entry, const sortKey key, uint64_t* packed) {
+    if (key == sortKey::colour) {
+        *packed = colourKey(entry);
+        return entry.hueKnown;
+    }
+
+    double value;
+    if (!sortValue(entry, key, &value))
+        return false;
+    *packed = orderedBits(value);
+    return true;
+}
+
+// FNV-1a, folded down to 31 bits for "colourKey"
+static uint32_t hashPath(const std::string& path) {
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : path) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return (uint32_t)(hash ^ (hash >> 32)) & 0x7fffffff;
+}
+
+// the first position whose value is at least "value", or "sortedCount" if there isn't one
+size_t lowerBound(const catalogOrder& order, const double value) {
+    return std::lower_bound(order.values.begin(), order.values.end(), value) - order.values.begin();
+}
+
+static size_t upperBound(const catalogOrder& order, const double value) {
+    return std::upper_bound(order.values.begin(), order.values.end(), value) - order.values.begin();
+}
+
+static double wrapHue(const double hue) {
+    double wrapped = fmod(hue, 360.0);
+    return wrapped < 0 ? wrapped + 360.0 : wrapped;
+}
+
+/* The positions of the images with a hue from "from" to "to" degrees (inclusive), going round the wheel, so 330 to 30 is the reds either side of 0
+ * That's one range, or two when it wraps past 360; it's two binary searches either way, so a million images take a few microseconds
+ */
+std::vector<positionRange> hueRange(const catalogOrder& byHue, const double from, const double to) {
+    const double start = wrapHue(from), end = wrapHue(to);
+    std::vector<positionRange> ranges;
+    if (to - from >= 360.0)
+        ranges.push_back({ 0, byHue.sortedCount });
+    else if (start <= end)
+        ranges.push_back({ lowerBound(byHue, start), upperBound(byHue, end) });
+    else {
+        ranges.push_back({ lowerBound(byHue, start), byHue.sortedCount });
+        ranges.push_back({ 0, upperBound(byHue, end) });
+    }
+
+    ranges.erase(std::remove_if(ranges.begin(), ranges.end(), [](const positionRange& r) { return r.first >= r.last; }), ranges.end());
+    return ranges;
+}
+
+// the position of the image whose hue is closest to "hue" going either way round the wheel, or SIZE_MAX if no hues are known yet
+size_t nearestHue(const catalogOrder& byHue, const double hue) {
+    if (byHue.sortedCount == 0)
+        return SIZE_MAX;
+
+    // the closest is either side of where "hue" would go, or at the far end of the order if it's closer round through 0
+    const double target = wrapHue(hue);
+    const size_t next = lowerBound(byHue, target);
+    const size_t candidates[4] = { next, next - 1, 0, byHue.sortedCount - 1 };
+
+    size_t best = SIZE_MAX;
+    double bestDistance = 360.0;
+    for (size_t candidate : candidates) {
+        if (candidate >= byHue.sortedCount) // "next - 1" wraps round to SIZE_MAX when "next" is 0
+            continue;
+        double distance = fabs(byHue.values[candidate] - target);
+        distance = std::min(distance, 360.0 - distance);
+        if (best == SIZE_MAX || distance < bestDistance) {
+            best = candidate;
+            bestDistance = distance;
+        }
+    }
+    return best;
+}
+
+// fills in "positions" and "sortedCount", once "ids" has the images with a value first
+static void finishOrder(catalogOrder& order, const size_t sortedCount) {
+    order.sortedCount = sortedCount;
+    order.positions.resize(order.ids.size());
+    for (size_t i = 0; i < order.ids.size(); i++)
+        order.positions[order.ids[i]] = i;
+}
+
+/* A full sort of the snapshot's entries by "key", equal values in the order they were added (like the hue order's skip list)
+ * Every key goes through the same radix sort; the ids are added in order and the sort is stable, which gives the ties their order
+ * It's one thread while images are still arriving, when the loading pool already has every core decoding; only the final sort, once loading is done, takes them all
+ */
+static std::shared_ptr<const catalogOrder> sortOrder(const catalogSnapshot& snapshot, const sortKey key) {
+    std::shared_ptr<catalogOrder> order = std::make_shared<catalogOrder>();
+    order->key = key;
+
+    std::vector<uint64_t> keys;
+    std::vector<uint32_t> ids;
+    std::vector<size_t> unknown;
+    keys.reserve(snapshot.entries.size());
+    ids.reserve(snapshot.entries.size());
+    for (auto& entry : snapshot.entries) {
+        uint64_t packed;
+        if (packedKey(*entry, key, &packed)) {
+            keys.push_back(packed);
+            ids.push_back((uint32_t)entry->id);
+        }
+        else
+            unknown.push_back(entry->id);
+    }
+    radixSort(keys, ids, snapshot.complete ? std::max(1u, std::thread::hardware_concurrency()) : 1u);
+
+    order->ids.reserve(snapshot.entries.size());
+    order->values.reserve(keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        order->ids.push_back(ids[i]);
+        order->values.push_back(key == sortKey::colour ? (double)keys[i] : fromOrderedBits(keys[i]));
+    }
+    order->ids.insert(order->ids.end(), unknown.begin(), unknown.end());
+    finishOrder(*order, keys.size());
+    return order;
+}
+
+// the file's size and last write time; either one that can't be read goes first when sorting by it (the filesystem clock's epoch can be after every real file, so it's the lowest value rather than 0)
+static void fileDetails(const std::string& path, uint64_t* size, int64_t* modified) {
+    std::error_code ec;
+    uintmax_t bytes = fs::file_size(path, ec);
+    *size = ec ? 0 : (uint64_t)bytes;
+    auto written = fs::last_write_time(path, ec);
+    *modified = ec ? INT64_MIN : (int64_t)written.time_since_epoch().count();
+}
+
+catalog::catalog() {
+    std::shared_ptr<catalogOrder> emptyOrder = std::make_shared<catalogOrder>(catalogOrder{ sortKey::hue, {}, {}, {}, 0 });
+    std::atomic_store(&this->current, std::shared_ptr<const catalogSnapshot>(std::make_shared<catalogSnapshot>(catalogSnapshot{ {}, emptyOrder, 0, false })));
+    this->lastPublished = std::chrono::steady_clock::now();
+    this->orderBuilder = std::thread(&catalog::buildOrders, this);
+}
+
+catalog::~catalog() {
+    {
+        std::lock_guard<std::mutex> lock(orderMutex);
+        this->stopping = true;
+    }
+    this->ordersWanted.notify_all();
+    this->orderBuilder.join();
+}
+
+void catalog::publishLocked() {
+    // the entries themselves are shared between versions, so a publish only copies pointers
+    std::shared_ptr<catalogSnapshot> next = std::make_shared<catalogSnapshot>();
+    next->entries = this->byId;
+
+    // the hue order is already sorted in the skip list, so it's only read out here
+    std::shared_ptr<catalogOrder> byHue = std::make_shared<catalogOrder>();
+    byHue->key = sortKey::hue;
+    byHue->ids.reserve(this->byId.size());
+    this->order.appendInOrder(byHue->ids);
+    size_t sortedCount = byHue->ids.size();
+    byHue->values.reserve(sortedCount);
+    for (size_t id : byHue->ids)
+        byHue->values.push_back(this->byId[id]->medianHue);
+    for (auto& entry : this->byId)
+        if (!entry->hueKnown)
+            byHue->ids.push_back(entry->id);
+    finishOrder(*byHue, sortedCount);
+    next->byHue = byHue;
+
+    next->version = ++this->version;
+    next->complete = this->complete;
+
+    std::atomic_store(&this->current, std::shared_ptr<const catalogSnapshot>(std::move(next)));
+
+    this->unpublished = 0;
+    this->lastPublished = std::chrono::steady_clock::now();
+
+    // taking the lock (even empty) means a viewer can't check the version and then start sleeping just after this notify, which would miss it
+    { std::lock_guard<std::mutex> lock(signalMutex); }
+    this->changed.notify_all();
+    // and the same for the order builder
+    { std::lock_guard<std::mutex> lock(orderMutex); }
+    this->ordersWanted.notify_one();
+}
+
+void catalog::changedLocked() {
+    this->unpublished++;
+
+    /* Publishing after every change would copy the whole catalog for each image, which is quadratic
+     * Instead a version goes out once the changes since the last one reach an eighth of the catalog, or 50ms have gone by
+     * The very first image always goes out straight away (0 / 8 == 0), so the viewer has something to show as soon as possible
+     */
+    if (this->unpublished > this->byId.size() / 8 || std::chrono::steady_clock::now() - this->lastPublished >= std::chrono::milliseconds(50))
+        this->publishLocked();
+}
+
+size_t catalog::add(const std::string& path, std::shared_ptr<const bitmap> thumbnail, std::shared_ptr<const bitmap> preview) {
+    uint64_t fileSize;
+    int64_t modified;
+    fileDetails(path, &fileSize, &modified); // before taking the lock, it's a filesystem call
+
+    std::lock_guard<std::mutex> lock(writerMutex);
+
+    size_t id = this->byId.size();
+    this->byId.push_back(std::make_shared<const catalogEntry>(catalogEntry{ id, path, 0, false, imageFeatures{}, fileSize, modified, hashPath(path), thumbnail, preview }));
+
+    this->changedLocked();
+    return id;
+}
+
+size_t catalog::add(const std::string& path, const double medianHue, const imageFeatures& features, std::shared_ptr<const bitmap> thumbnail, std::shared_ptr<const bitmap> preview) {
+    uint64_t fileSize;
+    int64_t modified;
+    fileDetails(path, &fileSize, &modified);
+
+    std::lock_guard<std::mutex> lock(writerMutex);
+
+    size_t id = this->byId.size();
+    this->byId.push_back(std::make_shared<const catalogEntry>(catalogEntry{ id, path, medianHue, true, features, fileSize, modified, hashPath(path), thumbnail, preview }));
+    this->order.insert(medianHue, id);
+
+    this->changedLocked();
+    return id;
+}
+
+void catalog::setHue(const size_t id, const double medianHue, const imageFeatures& features, const bool previewStored) {
+    std::lock_guard<std::mutex> lock(writerMutex);
+
+    // copy-on-write; the old entry may still be in a snapshot the viewer is using
+    catalogEntry updated = *this->byId[id];
+    if (updated.hueKnown)
+        return;
+    updated.medianHue = medianHue;
+    updated.hueKnown = true;
+    updated.features = features;
+    if (previewStored)
+        updated.preview = nullptr;
+    this->byId[id] = std::make_shared<const catalogEntry>(std::move(updated));
+    this->order.insert(medianHue, id);
+
+    this->changedLocked();
+}
+
+void catalog::publish() {
+    std::lock_guard<std::mutex> lock(writerMutex);
+    this->publishLocked();
+}
+
+void catalog::finish() {
+    uint64_t last;
+    {
+        std::lock_guard<std::mutex> lock(writerMutex);
+        this->complete = true;
+        this->publishLocked();
+        last = this->version;
+    }
+
+    // the builder doesn't wait between rounds for a complete catalog; this waits for it so every order is ready (and the sort stage's time includes them) by the time it returns
+    std::unique_lock<std::mutex> lock(orderMutex);
+    this->ordersReady.wait(lock, [this, last]() { return this->readyVersion >= last; });
+}
+
+/* The "orderBuilder" thread: sorts every key but the hue for the newest snapshot, then waits before doing it again, see "orders"
+ * The lock is only held to pick the snapshot and to hand the orders over, never while sorting
+ */
+void catalog::buildOrders() {
+    std::unique_lock<std::mutex> lock(orderMutex);
+
+    while (true) {
+        this->ordersWanted.wait(lock, [this]() { return this->stopping || this->snapshot()->version > this->startedVersion; });
+        if (this->stopping)
+            return;
+
+        std::shared_ptr<const catalogSnapshot> latest = this->snapshot();
+        this->startedVersion = latest->version;
+        lock.unlock();
+
+        auto start = std::chrono::steady_clock::now();
+        std::shared_ptr<const catalogOrder> built[SORT_KEYS];
+        for (int key = 0; key < SORT_KEYS; key++)
+            if ((sortKey)key != sortKey::hue)
+                built[key] = sortOrder(*latest, (sortKey)key);
+        auto took = std::chrono::steady_clock::now() - start;
+
+        lock.lock();
+        for (int key = 0; key < SORT_KEYS; key++)
+            if (built[key] != nullptr)
+                std::atomic_store(&this->orders[key], built[key]);
+        this->readyVersion = latest->version;
+        this->ordersReady.notify_all();
+
+        if (!latest->complete) {
+            auto next = std::chrono::steady_clock::now() + std::max<std::chrono::steady_clock::duration>(ORDER_REBUILD_INTERVAL, took * 4);
+            this->ordersWanted.wait_until(lock, next, [this]() { return this->stopping || this->snapshot()->complete; });
+        }
+    }
+}
+
+/* The images in the order of "key", and in "snapshot" the newest snapshot to browse them in
+ * The hue order comes with the snapshot; any other is the latest one the builder has made, or null before its first round
+ * That can be from an older snapshot while images are still arriving, so it may not have the newest images yet; ids are never reused, so those it has are the same images
+ * The order is loaded first: it was made from a snapshot published before it, so the snapshot loaded after always has every id in it, where the other way round a round could finish in between
+ * They're atomic loads either way, so switching keys never sorts or waits on the UI thread
+ */
+std::shared_ptr<const catalogOrder> catalog::orderBy(const sortKey key, std::shared_ptr<const catalogSnapshot>* snapshot) const {
+    std::shared_ptr<const catalogOrder> ready = key == sortKey::hue ? nullptr : std::atomic_load(&this->orders[(int)key]);
+    *snapshot = this->snapshot();
+    return key == sortKey::hue ? (*snapshot)->byHue : ready;
+}
+
+// wakes the viewer as soon as a snapshot newer than "version" is published, returns whether one was
+bool catalog::waitForChange(const uint64_t version, const std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(signalMutex);
+    return this->changed.wait_for(lock, timeout, [this, version]() { return std::atomic_load(&this->current)->version != version; });
+}
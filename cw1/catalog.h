@@ -0,0 +1,113 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "image.h"
+#include "skiplist.h"
+
+// what the viewer needs to know about one image; entries are never modified once published, a change means a new entry replaces the old one
+typedef struct {
+	size_t id; // the order the image was added in, stays the same however the catalog is sorted
+	std::string path;
+	double medianHue; // degrees
+	bool hueKnown;
+	imageFeatures features; // known along with the hue, or estimated from the preview when the hue came from somewhere else
+	uint64_t fileSize;
+	int64_t modified; // the file's last write time, in the filesystem clock's ticks
+	uint32_t pathHash; // 31 bits, breaks ties in the colour order; unlike "id" it's the same every run
+	std::shared_ptr<const bitmap> thumbnail; // may be null, e.g. when the image came from the thumbnail store
+	std::shared_ptr<const bitmap> preview; // null once it's been written to the thumbnail store
+} catalogEntry;
+
+// what the viewer can order the images by; all but the hue come from the features, or from the file itself
+enum class sortKey { hue, saturation, brightness, fileSize, date, perceptual, colour };
+#define SORT_KEYS 7
+// the least time between two rounds of sorting the other keys while images are still arriving, see "catalog::buildOrders"
+#define ORDER_REBUILD_INTERVAL std::chrono::milliseconds(250)
+
+std::string sortKeyName(sortKey key);
+
+// the images in the order of one key, as a permutation of ids so every key shares the one set of entries
+typedef struct {
+	sortKey key;
+	std::vector<size_t> ids; // the first "sortedCount" are in order, the rest have no value for the key yet and are in the order they were added
+	std::vector<size_t> positions; // id -> index in "ids"
+	std::vector<double> values; // the key of each of the first "sortedCount", so a value's position is a binary search over these alone, without touching any entries (the colour order's are its packed keys, as near as a double holds them)
+	size_t sortedCount;
+} catalogOrder;
+
+// positions in a "catalogOrder", from "first" up to but not including "last"
+typedef struct {
+	size_t first;
+	size_t last;
+} positionRange;
+
+uint64_t colourKey(const catalogEntry& entry);
+size_t lowerBound(const catalogOrder& order, double value);
+std::vector<positionRange> hueRange(const catalogOrder& byHue, double from, double to);
+size_t nearestHue(const catalogOrder& byHue, double hue);
+
+// one immutable version of the catalog, the viewer holds onto one of these while drawing so nothing can change underneath it
+typedef struct {
+	std::vector<std::shared_ptr<const catalogEntry>> entries; // by id
+	std::shared_ptr<const catalogOrder> byHue; // kept up to date as each hue arrives, the other orders come from "catalog::orderBy"
+	uint64_t version;
+	bool complete; // true once no more images will be added
+} catalogSnapshot;
+
+/* The images as the viewer sees them, published read-copy-update style
+ * The loading and hue threads change a private working copy (serialised by "writerMutex") and then publish it as a new immutable snapshot
+ * The viewer only ever does an atomic load of the latest snapshot, so it never takes a lock and never sees a half-finished "push_back" or sort
+ * Each image joins the hue order as soon as its hue is known, so the sorted part of the catalog can be browsed while the rest is still processing
+ */
+class catalog
+{
+private:
+	std::shared_ptr<const catalogSnapshot> current; // only accessed through "std::atomic_load"/"std::atomic_store"
+	std::vector<std::shared_ptr<const catalogEntry>> byId;
+	orderedSkipList order; // ids of the images whose hue is known
+	uint64_t version = 0;
+	size_t unpublished = 0;
+	bool complete = false;
+	std::chrono::steady_clock::time_point lastPublished;
+	std::mutex writerMutex;
+	std::mutex signalMutex; // only used to sleep on "changed", readers still never lock to get a snapshot
+	std::condition_variable changed;
+
+	/* The latest order for each of the other keys (only accessed through "std::atomic_load"/"std::atomic_store"), and the snapshot version they were all made from
+	 * They're sorted on the catalog's own thread, "buildOrders", never the viewer's: a publish wakes it, and it sorts every key for the newest snapshot in one go
+	 * After a round it waits ORDER_REBUILD_INTERVAL, or four times as long as the round took if that's longer, so while images are still arriving the sorts run at most a fifth of the time
+	 * The wait is skipped once the catalog is complete, so the final orders are ready as soon as possible
+	 */
+	std::shared_ptr<const catalogOrder> orders[SORT_KEYS];
+	uint64_t startedVersion = 0; // of the snapshot the current (or last) round is sorting
+	uint64_t readyVersion = 0; // of the snapshot the orders in "orders" were made from
+	bool stopping = false;
+	std::mutex orderMutex;
+	std::condition_variable ordersWanted;
+	std::condition_variable ordersReady;
+	std::thread orderBuilder;
+
+	void publishLocked();
+	void changedLocked();
+	void buildOrders();
+public:
+	catalog();
+	~catalog();
+	catalog(const catalog&) = delete;
+	catalog& operator=(const catalog&) = delete;
+	[[nodiscard]] std::shared_ptr<const catalogSnapshot> snapshot() const { return std::atomic_load(&current); }
+	size_t add(const std::string& path, std::shared_ptr<const bitmap> thumbnail, std::shared_ptr<const bitmap> preview);
+	size_t add(const std::string& path, double medianHue, const imageFeatures& features, std::shared_ptr<const bitmap> thumbnail, std::shared_ptr<const bitmap> preview);
+	// "previewStored" drops the entry's preview, as the viewer can read it back from the thumbnail store
+	void setHue(size_t id, double medianHue, const imageFeatures& features, bool previewStored = false);
+	void publish();
+	void finish();
+	std::shared_ptr<const catalogOrder> orderBy(sortKey key, std::shared_ptr<const catalogSnapshot>* snapshot) const;
+	bool waitForChange(uint64_t version, std::chrono::milliseconds timeout);
+};
@@ -0,0 +1,480 @@
+#include "decoder.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stb_image.h>
+#include "hue.h"
+
+#ifdef HAVE_LIBJPEG
+#include <csetjmp>
+#include <numeric>
+#include <jpeglib.h>
+#endif
+
+static const imageFormat FORMATS[] = { imageFormat::jpeg, imageFormat::png, imageFormat::gif, imageFormat::bmp, imageFormat::other };
+
+imageFormat detectFormat(const uint8_t* data, const size_t size) {
+    if (size >= 3 && data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF)
+        return imageFormat::jpeg;
+    if (size >= 4 && memcmp(data, "\x89PNG", 4) == 0)
+        return imageFormat::png;
+    if (size >= 4 && memcmp(data, "GIF8", 4) == 0)
+        return imageFormat::gif;
+    if (size >= 2 && data[0] == 'B' && data[1] == 'M')
+        return imageFormat::bmp;
+    return imageFormat::other;
+}
+
+const char* formatName(const imageFormat format) {
+    switch (format) {
+    case imageFormat::jpeg: return "jpeg";
+    case imageFormat::png: return "png";
+    case imageFormat::gif: return "gif";
+    case imageFormat::bmp: return "bmp";
+    default: return "other";
+    }
+}
+
+bool stbDecoder::info(const uint8_t* data, const size_t size, int* width, int* height, int* channels, std::string* error) const {
+    if (stbi_info_from_memory(data, (int)size, width, height, channels))
+        return true;
+    *error = stbi_failure_reason();
+    return false;
+}
+
+bool stbDecoder::decode(const uint8_t* data, const size_t size, decodedImage& out, std::string* error) const {
+    stbi_uc* pixels = stbi_load_from_memory(data, (int)size, &out.width, &out.height, &out.channels, 0);
+    if (pixels == nullptr) {
+        *error = stbi_failure_reason();
+        return false;
+    }
+
+    out.pixels.assign(pixels, pixels + (size_t)out.width * out.height * out.channels);
+    stbi_image_free(pixels);
+    return true;
+}
+
+#ifdef HAVE_LIBJPEG
+/* libjpeg reports errors by calling "error_exit", which by default prints and exits the whole program
+ * This one keeps the message and jumps back to the "setjmp" in the function that started the decode
+ */
+typedef struct {
+    struct jpeg_error_mgr manager; // has to be first, libjpeg only knows about this part
+    jmp_buf jump;
+    char message[JMSG_LENGTH_MAX];
+} jpegErrorHandler;
+
+static void jpegErrorExit(j_common_ptr info) {
+    jpegErrorHandler* handler = reinterpret_cast<jpegErrorHandler*>(info->err);
+    (*info->err->format_message)(info, handler->message);
+    longjmp(handler->jump, 1);
+}
+
+// warnings (e.g. a truncated file that still decodes) would otherwise be printed to stderr
+static void jpegIgnoreMessage(j_common_ptr) {}
+
+bool jpegDecoder::info(const uint8_t* data, const size_t size, int* width, int* height, int* channels, std::string* error) const {
+    struct jpeg_decompress_struct info;
+    jpegErrorHandler handler;
+    info.err = jpeg_std_error(&handler.manager);
+    handler.manager.error_exit = jpegErrorExit;
+    handler.manager.output_message = jpegIgnoreMessage;
+
+    if (setjmp(handler.jump)) {
+        jpeg_destroy_decompress(&info);
+        *error = handler.message;
+        return false;
+    }
+
+    jpeg_create_decompress(&info);
+    jpeg_mem_src(&info, data, (unsigned long)size);
+    jpeg_read_header(&info, TRUE);
+
+    *width = (int)info.image_width;
+    *height = (int)info.image_height;
+    *channels = info.num_components == 1 ? 1 : 3;
+    jpeg_destroy_decompress(&info);
+    return true;
+}
+
+bool jpegDecoder::decode(const uint8_t* data, const size_t size, decodedImage& out, std::string* error) const {
+    struct jpeg_decompress_struct info;
+    jpegErrorHandler handler;
+    info.err = jpeg_std_error(&handler.manager);
+    handler.manager.error_exit = jpegErrorExit;
+    handler.manager.output_message = jpegIgnoreMessage;
+
+    if (setjmp(handler.jump)) {
+        jpeg_destroy_decompress(&info);
+        *error = handler.message;
+        return false;
+    }
+
+    jpeg_create_decompress(&info);
+    jpeg_mem_src(&info, data, (unsigned long)size);
+    jpeg_read_header(&info, TRUE);
+
+    // libjpeg-turbo can't turn CMYK into RGB, stb can, so those are left to the fallback
+    if (info.jpeg_color_space == JCS_CMYK || info.jpeg_color_space == JCS_YCCK) {
+        jpeg_destroy_decompress(&info);
+        *error = "CMYK JPEGs aren't supported by libjpeg-turbo";
+        return false;
+    }
+
+    info.out_color_space = info.num_components == 1 ? JCS_GRAYSCALE : JCS_RGB;
+    jpeg_start_decompress(&info);
+
+    out.width = (int)info.output_width;
+    out.height = (int)info.output_height;
+    out.channels = info.output_components;
+    out.pixels.resize((size_t)out.width * out.height * out.channels);
+
+    // the rows are decoded straight into the image's buffer, a few at a time as libjpeg prefers, so unlike stb there's no copy afterwards
+    const size_t stride = (size_t)out.width * out.channels;
+    while (info.output_scanline < info.output_height) {
+        JSAMPROW rows[4];
+        for (int i = 0; i < 4; i++)
+            rows[i] = out.pixels.data() + std::min<size_t>(info.output_scanline + i, info.output_height - 1) * stride;
+        jpeg_read_scanlines(&info, rows, std::min<JDIMENSION>(4, info.output_height - info.output_scanline));
+    }
+
+    jpeg_finish_decompress(&info);
+    jpeg_destroy_decompress(&info);
+    return true;
+}
+
+// rows are handed over in bands of this many, enough for one row of MCUs in a 4:2:0 JPEG
+#define JPEG_BAND_ROWS 16
+
+/* Decodes a band of rows at a time into one small buffer and hands each band to "sink" before decoding the next
+ * So however big the image, only the band (plus libjpeg's own few rows of state) is ever held
+ */
+bool jpegDecoder::decodeBands(const uint8_t* data, const size_t size, bandSink& sink, std::string* error) const {
+    std::vector<JSAMPLE> band; // declared before "setjmp" so that jumping back to it never skips its destructor
+
+    struct jpeg_decompress_struct info;
+    jpegErrorHandler handler;
+    info.err = jpeg_std_error(&handler.manager);
+    handler.manager.error_exit = jpegErrorExit;
+    handler.manager.output_message = jpegIgnoreMessage;
+
+    if (setjmp(handler.jump)) {
+        jpeg_destroy_decompress(&info);
+        *error = handler.message;
+        return false;
+    }
+
+    jpeg_create_decompress(&info);
+    jpeg_mem_src(&info, data, (unsigned long)size);
+    jpeg_read_header(&info, TRUE);
+
+    if (info.jpeg_color_space == JCS_CMYK || info.jpeg_color_space == JCS_YCCK) {
+        jpeg_destroy_decompress(&info);
+        *error = "CMYK JPEGs aren't supported by libjpeg-turbo";
+        return false;
+    }
+
+    info.out_color_space = info.num_components == 1 ? JCS_GRAYSCALE : JCS_RGB;
+    jpeg_start_decompress(&info);
+
+    const size_t stride = (size_t)info.output_width * info.output_components;
+    band.resize(stride * JPEG_BAND_ROWS);
+    sink.begin((int)info.output_width, (int)info.output_height, info.output_components);
+
+    while (info.output_scanline < info.output_height) {
+        JDIMENSION first = info.output_scanline;
+        while (info.output_scanline < info.output_height && info.output_scanline - first < JPEG_BAND_ROWS) {
+            JSAMPROW row = band.data() + (info.output_scanline - first) * stride;
+            jpeg_read_scanlines(&info, &row, 1);
+        }
+        sink.addRows(band.data(), (int)(info.output_scanline - first));
+
+        if (sink.cancelled()) {
+            jpeg_destroy_decompress(&info);
+            *error = "cancelled";
+            return false;
+        }
+    }
+
+    jpeg_finish_decompress(&info);
+    jpeg_destroy_decompress(&info);
+    return true;
+}
+
+/* Every possible (Cb, Cr) pair's hue, and those pairs in order of hue
+ * Converting YCbCr to RGB adds Y to all three channels equally (R = Y + 1.402Cr, G = Y - 0.344136Cb - 0.714136Cr, B = Y + 1.772Cb), which doesn't change which one is biggest or the differences between them
+ * So the hue only depends on Cb and Cr, and there are only 65536 of those to work out, once
+ */
+typedef struct {
+    std::vector<double> hues; // by "Cb * 256 + Cr"
+    std::vector<uint16_t> byHue; // the pairs sorted by hue, for taking the median of a histogram
+} chromaHueTable;
+
+static const chromaHueTable& chromaHues() {
+    static const chromaHueTable table = []() {
+        chromaHueTable built;
+        built.hues.resize(256 * 256);
+        for (int cb = 0; cb < 256; cb++) {
+            for (int cr = 0; cr < 256; cr++) {
+                double b = cb - 128.0, r = cr - 128.0;
+                built.hues[cb * 256 + cr] = hueDegrees(1.402 * r, -0.344136 * b - 0.714136 * r, 1.772 * b);
+            }
+        }
+
+        built.byHue.resize(256 * 256);
+        std::iota(built.byHue.begin(), built.byHue.end(), 0);
+        std::stable_sort(built.byHue.begin(), built.byHue.end(), [&built](uint16_t a, uint16_t b) { return built.hues[a] < built.hues[b]; });
+        return built;
+    }();
+    return table;
+}
+
+/* The median hue of a JPEG taken straight from its Cb and Cr planes, at whatever resolution they're stored at
+ * libjpeg's raw output skips chroma upsampling and the conversion to RGB, and the hue of each chroma sample is a table lookup rather than "planarHues"
+ * With 4:2:0 subsampling each sample stands for four pixels, so counting each once gives the same median as counting every pixel
+ * The only difference from the RGB median is where RGB would have been clipped to 0-255, which can shift the hue of very saturated, very dark or very bright pixels
+ * If "ycbcr" isn't null it's also handed every row of the image as Y, Cb, Cr (or just Y for a greyscale JPEG) in the same pass, each chroma sample repeated across the pixels it covers rather than interpolated; that's enough for a box-filtered preview, see "ycbcrPreviews"
+ */
+bool jpegChromaMedianHue(const uint8_t* data, const size_t size, double* medianHue, bandSink* ycbcr, std::string* error) {
+    // declared before "setjmp" so that jumping back to it never skips their destructors
+    std::vector<std::vector<JSAMPLE>> planes(3);
+    std::vector<std::vector<JSAMPROW>> rows(3);
+    std::vector<std::vector<uint32_t>> columns(3); // the sample in each component's row that each pixel of the image comes from
+    std::vector<uint32_t> histogram(256 * 256, 0);
+    std::vector<uint8_t> band;
+
+    struct jpeg_decompress_struct info;
+    jpegErrorHandler handler;
+    info.err = jpeg_std_error(&handler.manager);
+    handler.manager.error_exit = jpegErrorExit;
+    handler.manager.output_message = jpegIgnoreMessage;
+
+    if (setjmp(handler.jump)) {
+        jpeg_destroy_decompress(&info);
+        *error = handler.message;
+        return false;
+    }
+
+    jpeg_create_decompress(&info);
+    jpeg_mem_src(&info, data, (unsigned long)size);
+    jpeg_read_header(&info, TRUE);
+
+    // a greyscale image's hue is 0 everywhere, which is what "hueDegrees" says for grey too; it's only decoded if its rows are wanted
+    const bool grey = info.jpeg_color_space == JCS_GRAYSCALE;
+    if (grey && !ycbcr) {
+        jpeg_destroy_decompress(&info);
+        *medianHue = 0;
+        return true;
+    }
+    if (!grey && (info.jpeg_color_space != JCS_YCbCr || info.num_components != 3)) {
+        jpeg_destroy_decompress(&info);
+        *error = "only YCbCr JPEGs have chroma planes";
+        return false;
+    }
+
+    // the two chroma planes always have the same size in practice; if not, their samples don't line up and this gives up
+    if (!grey && (info.comp_info[1].h_samp_factor != info.comp_info[2].h_samp_factor || info.comp_info[1].v_samp_factor != info.comp_info[2].v_samp_factor)) {
+        jpeg_destroy_decompress(&info);
+        *error = "the Cb and Cr planes are different sizes";
+        return false;
+    }
+
+    info.raw_data_out = TRUE;
+    jpeg_start_decompress(&info);
+
+    // each call hands back one row of MCUs, which is "v_samp_factor" blocks of 8 rows for each component
+    const int components = info.num_components;
+    const size_t mcuRows = (size_t)info.max_v_samp_factor * DCTSIZE;
+    JSAMPARRAY componentRows[3];
+    for (int c = 0; c < components; c++) {
+        jpeg_component_info& component = info.comp_info[c];
+        size_t width = (size_t)component.width_in_blocks * DCTSIZE;
+        size_t height = (size_t)component.v_samp_factor * DCTSIZE;
+        planes[c].resize(width * height);
+        for (size_t y = 0; y < height; y++)
+            rows[c].push_back(planes[c].data() + y * width);
+        componentRows[c] = rows[c].data();
+
+        columns[c].resize(info.output_width);
+        for (JDIMENSION x = 0; x < info.output_width; x++)
+            columns[c][x] = (uint32_t)((uint64_t)x * component.h_samp_factor / info.max_h_samp_factor);
+    }
+
+    if (ycbcr) {
+        band.resize(mcuRows * info.output_width * components);
+        ycbcr->begin((int)info.output_width, (int)info.output_height, components);
+    }
+
+    // a greyscale JPEG has only the one component, so there's no chroma to count
+    const jpeg_component_info& cb = info.comp_info[grey ? 0 : 1];
+    const size_t chromaRows = grey ? 0 : (size_t)cb.v_samp_factor * DCTSIZE;
+    const size_t chromaWidth = (size_t)cb.width_in_blocks * DCTSIZE;
+    uint64_t samples = 0;
+
+    JDIMENSION chromaRow = 0;
+    while (info.output_scanline < info.output_height) {
+        const JDIMENSION firstRow = info.output_scanline;
+        if (jpeg_read_raw_data(&info, componentRows, (JDIMENSION)mcuRows) == 0)
+            break;
+
+        // the planes are padded out to whole blocks, only the samples inside the image count
+        for (size_t y = 0; y < chromaRows && chromaRow < cb.downsampled_height; y++, chromaRow++) {
+            const JSAMPLE* cbRow = rows[1][y];
+            const JSAMPLE* crRow = rows[2][y];
+            for (size_t x = 0; x < cb.downsampled_width && x < chromaWidth; x++)
+                histogram[cbRow[x] * 256 + crRow[x]]++;
+            samples += std::min<size_t>(cb.downsampled_width, chromaWidth);
+        }
+
+        if (!ycbcr)
+            continue;
+
+        const int count = (int)std::min<size_t>(mcuRows, info.output_height - firstRow);
+        for (int y = 0; y < count; y++) {
+            uint8_t* row = band.data() + (size_t)y * info.output_width * components;
+            for (int c = 0; c < components; c++) {
+                const JSAMPLE* source = rows[c][(size_t)y * info.comp_info[c].v_samp_factor / info.max_v_samp_factor];
+                const uint32_t* column = columns[c].data();
+                for (JDIMENSION x = 0; x < info.output_width; x++)
+                    row[(size_t)x * components + c] = source[column[x]];
+            }
+        }
+        ycbcr->addRows(band.data(), count);
+
+        if (ycbcr->cancelled()) {
+            jpeg_destroy_decompress(&info);
+            *error = "cancelled";
+            return false;
+        }
+    }
+
+    jpeg_abort_decompress(&info);
+    jpeg_destroy_decompress(&info);
+
+    if (grey) {
+        *medianHue = 0;
+        return true;
+    }
+    if (samples == 0) {
+        *error = "no chroma samples were decoded";
+        return false;
+    }
+
+    // the median is the middle of the histogram walked in hue order, averaged across the two middle samples when there's an even number, like "calculateMedianHue"
+    const chromaHueTable& table = chromaHues();
+    const uint64_t lower = (samples - 1) / 2, upper = samples / 2;
+    double lowerHue = 0;
+    uint64_t seen = 0;
+    for (uint16_t pair : table.byHue) {
+        uint64_t before = seen;
+        seen += histogram[pair];
+        if (before <= lower && lower < seen)
+            lowerHue = table.hues[pair];
+        if (before <= upper && upper < seen) {
+            *medianHue = (lowerHue + table.hues[pair]) / 2;
+            return true;
+        }
+    }
+
+    *error = "no chroma samples were decoded";
+    return false;
+}
+#endif
+
+decoderRegistry& decoders() {
+    static decoderRegistry registry;
+    return registry;
+}
+
+decoderRegistry::decoderRegistry() {
+    this->backends.push_back(std::make_unique<stbDecoder>());
+#ifdef HAVE_LIBJPEG
+    this->backends.push_back(std::make_unique<jpegDecoder>());
+#endif
+
+    for (imageFormat format : FORMATS)
+        this->chosen[format] = this->backends.front().get();
+}
+
+const imageDecoder& decoderRegistry::decoderFor(const imageFormat format) const {
+    return *this->chosen.at(format);
+}
+
+// false if there's no backend of that name built in, or it can't decode that format
+bool decoderRegistry::choose(const imageFormat format, const std::string& name) {
+    for (const std::unique_ptr<imageDecoder>& backend : this->backends) {
+        if (backend->getName() == name && backend->supports(format)) {
+            this->chosen[format] = backend.get();
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Picks the fastest backend for each format from a benchmark's results ("format,backend,megapixels per second" lines)
+ * Backends in the file that weren't built into this binary are skipped, so a result from another build can't pick something that isn't there
+ */
+bool decoderRegistry::loadThroughput(const std::string& path) {
+    std::ifstream csv(path);
+    if (!csv.is_open())
+        return false;
+
+    std::map<imageFormat, double> best;
+    std::string line;
+    while (std::getline(csv, line)) {
+        std::stringstream fields(line);
+        std::string format, backend, throughput;
+        if (!std::getline(fields, format, ',') || !std::getline(fields, backend, ',') || !std::getline(fields, throughput))
+            continue;
+
+        for (imageFormat candidate : FORMATS) {
+            if (format != formatName(candidate))
+                continue;
+
+            double megapixelsPerSecond = std::strtod(throughput.c_str(), nullptr);
+            if (megapixelsPerSecond > best[candidate] && this->choose(candidate, backend))
+                best[candidate] = megapixelsPerSecond;
+        }
+    }
+
+    return !best.empty();
+}
+
+// any backend that can stream this file's format will do, whichever one has been chosen for a full decode
+bool decoderRegistry::decodeBands(const uint8_t* data, const size_t size, bandSink& sink, std::string* error) const {
+    imageFormat format = detectFormat(data, size);
+    for (const std::unique_ptr<imageDecoder>& backend : this->backends)
+        if (backend->supports(format) && backend->decodeBands(data, size, sink, error))
+            return true;
+    return false;
+}
+
+/* False unless hue from chroma is turned on and this file is a JPEG, in which case the caller decodes it and works the hue out from the pixels as usual
+ * "ycbcr" (if not null) gets the image's rows from the same pass, see "jpegChromaMedianHue"
+ */
+bool decoderRegistry::medianHue([[maybe_unused]] const uint8_t* data, [[maybe_unused]] const size_t size, [[maybe_unused]] double* hue, [[maybe_unused]] bandSink* ycbcr) const {
+#ifdef HAVE_LIBJPEG
+    std::string error;
+    return this->chromaHue && detectFormat(data, size) == imageFormat::jpeg && jpegChromaMedianHue(data, size, hue, ycbcr, &error);
+#else
+    return false;
+#endif
+}
+
+bool decoderRegistry::info(const uint8_t* data, const size_t size, int* width, int* height, int* channels, std::string* error) const {
+    const imageDecoder& decoder = this->decoderFor(detectFormat(data, size));
+    if (decoder.info(data, size, width, height, channels, error))
+        return true;
+    return &decoder != this->backends.front().get() && this->backends.front()->info(data, size, width, height, channels, error);
+}
+
+// a backend can turn down a file the default copes with, so that gets a second try with stb rather than being skipped
+bool decoderRegistry::decode(const uint8_t* data, const size_t size, decodedImage& out, std::string* error) const {
+    const imageDecoder& decoder = this->decoderFor(detectFormat(data, size));
+    if (decoder.decode(data, size, out, error))
+        return true;
+    return &decoder != this->backends.front().get() && this->backends.front()->decode(data, size, out, error);
+}
@@ -0,0 +1,108 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "bufferpool.h"
+
+// measured decode throughput from "--benchmark-decoders", read back at startup to pick the fastest backend for each format
+#define DECODER_BENCHMARK "decoders.csv"
+
+enum class imageFormat { jpeg, png, gif, bmp, other };
+
+imageFormat detectFormat(const uint8_t* data, size_t size);
+const char* formatName(imageFormat format);
+
+typedef struct {
+	pixelBuffer pixels; // interleaved, "channels" bytes per pixel
+	int width;
+	int height;
+	int channels;
+} decodedImage;
+
+// takes a decode a band of rows at a time, from the decoders that can stream ("imageDecoder::decodeBands")
+class bandSink
+{
+public:
+	virtual ~bandSink() = default;
+	virtual void begin(int width, int height, int channels) = 0;
+	virtual void addRows(const uint8_t* rows, int count) = 0; // "count" whole rows, tightly packed
+	[[nodiscard]] virtual bool cancelled() const { return false; } // checked after each band, the decode stops (and fails) once it's true
+};
+
+/* One way of turning a file's bytes into pixels
+ * Backends are shared by every decoding thread, so "info" and "decode" must not keep any state between calls
+ * Pixels come back with however many channels the file has (1 to 4), the same as "stbi_load" with no requested channel count
+ */
+class imageDecoder
+{
+public:
+	virtual ~imageDecoder() = default;
+	[[nodiscard]] virtual std::string getName() const = 0;
+	[[nodiscard]] virtual bool supports(imageFormat format) const = 0;
+	virtual bool info(const uint8_t* data, size_t size, int* width, int* height, int* channels, std::string* error) const = 0;
+	virtual bool decode(const uint8_t* data, size_t size, decodedImage& out, std::string* error) const = 0;
+	// only some backends can hand over the pixels as they're decoded, rather than all at once at the end
+	virtual bool decodeBands(const uint8_t*, size_t, bandSink&, std::string* error) const { *error = getName() + " can't stream"; return false; }
+};
+
+// decodes everything, so it's the default for every format and the fallback when another backend turns a file down
+class stbDecoder : public imageDecoder
+{
+public:
+	[[nodiscard]] std::string getName() const override { return "stb_image"; }
+	[[nodiscard]] bool supports(imageFormat) const override { return true; }
+	bool info(const uint8_t* data, size_t size, int* width, int* height, int* channels, std::string* error) const override;
+	bool decode(const uint8_t* data, size_t size, decodedImage& out, std::string* error) const override;
+};
+
+#ifdef HAVE_LIBJPEG
+// libjpeg-turbo's SIMD decoder, several times quicker than stb's on baseline JPEGs; only built when CMake finds libjpeg
+class jpegDecoder : public imageDecoder
+{
+public:
+	[[nodiscard]] std::string getName() const override { return "libjpeg-turbo"; }
+	[[nodiscard]] bool supports(imageFormat format) const override { return format == imageFormat::jpeg; }
+	bool info(const uint8_t* data, size_t size, int* width, int* height, int* channels, std::string* error) const override;
+	bool decode(const uint8_t* data, size_t size, decodedImage& out, std::string* error) const override;
+	bool decodeBands(const uint8_t* data, size_t size, bandSink& sink, std::string* error) const override;
+};
+
+bool jpegChromaMedianHue(const uint8_t* data, size_t size, double* medianHue, bandSink* ycbcr, std::string* error);
+#endif
+
+/* Every backend that was built in, and which one is used for each format
+ * The choice starts as stb for everything and is only changed at startup (from "DECODER_BENCHMARK" or the command line), before any decoding starts, so lookups don't need a lock
+ */
+class decoderRegistry
+{
+private:
+	std::vector<std::unique_ptr<imageDecoder>> backends; // the first is the default
+	std::map<imageFormat, const imageDecoder*> chosen;
+	bool chromaHue = false;
+	bool exifThumbnails = false;
+	bool streaming = false;
+public:
+	decoderRegistry();
+	~decoderRegistry() = default;
+	decoderRegistry(const decoderRegistry&) = delete;
+	decoderRegistry& operator=(const decoderRegistry&) = delete;
+	[[nodiscard]] const std::vector<std::unique_ptr<imageDecoder>>& getBackends() const { return backends; }
+	[[nodiscard]] const imageDecoder& decoderFor(imageFormat format) const;
+	bool choose(imageFormat format, const std::string& name);
+	bool loadThroughput(const std::string& path);
+	void setChromaHue(bool enabled) { chromaHue = enabled; }
+	[[nodiscard]] bool getChromaHue() const { return chromaHue; }
+	bool medianHue(const uint8_t* data, size_t size, double* hue, bandSink* ycbcr = nullptr) const;
+	void setExifThumbnails(bool enabled) { exifThumbnails = enabled; }
+	[[nodiscard]] bool getExifThumbnails() const { return exifThumbnails; }
+	void setStreaming(bool enabled) { streaming = enabled; }
+	[[nodiscard]] bool getStreaming() const { return streaming; }
+	bool decodeBands(const uint8_t* data, size_t size, bandSink& sink, std::string* error) const;
+	bool info(const uint8_t* data, size_t size, int* width, int* height, int* channels, std::string* error) const;
+	bool decode(const uint8_t* data, size_t size, decodedImage& out, std::string* error) const;
+};
+
+// the registry every decode goes through
+decoderRegistry& decoders();
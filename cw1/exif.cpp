@@ -0,0 +1,103 @@
+#include "exif.h"
+#include <cstring>
+
+// the fields EXIF's TIFF structure is made of, in whichever byte order the header says
+static uint16_t readShort(const uint8_t* at, const bool bigEndian) {
+    return bigEndian ? (uint16_t)(at[0] << 8 | at[1]) : (uint16_t)(at[1] << 8 | at[0]);
+}
+
+static uint32_t readLong(const uint8_t* at, const bool bigEndian) {
+    return bigEndian ? (uint32_t)at[0] << 24 | (uint32_t)at[1] << 16 | (uint32_t)at[2] << 8 | at[3]
+                     : (uint32_t)at[3] << 24 | (uint32_t)at[2] << 16 | (uint32_t)at[1] << 8 | at[0];
+}
+
+/* The thumbnail is described by the second IFD ("IFD1"), which follows the main image's IFD0
+ * Its offset (tag 0x0201) and length (0x0202) are relative to the start of the TIFF header, and everything is bounds checked as this comes straight from the file
+ */
+static bool findTiffThumbnail(const uint8_t* tiff, const size_t size, const uint8_t** thumbnail, size_t* thumbnailSize) {
+    if (size < 8)
+        return false;
+
+    bool bigEndian;
+    if (memcmp(tiff, "MM\0*", 4) == 0)
+        bigEndian = true;
+    else if (memcmp(tiff, "II*\0", 4) == 0)
+        bigEndian = false;
+    else
+        return false;
+
+    uint32_t ifd0 = readLong(tiff + 4, bigEndian);
+    if (ifd0 > size - 2)
+        return false;
+
+    uint32_t entries = readShort(tiff + ifd0, bigEndian);
+    uint64_t next = (uint64_t)ifd0 + 2 + (uint64_t)entries * 12;
+    if (next > size - 4)
+        return false;
+
+    uint32_t ifd1 = readLong(tiff + next, bigEndian);
+    if (ifd1 == 0 || ifd1 > size - 2)
+        return false;
+
+    entries = readShort(tiff + ifd1, bigEndian);
+    if ((uint64_t)ifd1 + 2 + (uint64_t)entries * 12 > size)
+        return false;
+
+    uint32_t offset = 0, length = 0;
+    for (uint32_t i = 0; i < entries; i++) {
+        const uint8_t* entry = tiff + ifd1 + 2 + i * 12;
+        uint16_t tag = readShort(entry, bigEndian);
+        uint16_t type = readShort(entry + 2, bigEndian);
+        // written as a LONG by nearly everything, but a SHORT is allowed too
+        uint32_t value = type == 3 ? readShort(entry + 8, bigEndian) : readLong(entry + 8, bigEndian);
+
+        if (tag == 0x0201)
+            offset = value;
+        else if (tag == 0x0202)
+            length = value;
+    }
+
+    if (offset == 0 || length < 4 || offset > size || length > size - offset)
+        return false;
+    if (tiff[offset] != 0xFF || tiff[offset + 1] != 0xD8)
+        return false;
+
+    *thumbnail = tiff + offset;
+    *thumbnailSize = length;
+    return true;
+}
+
+/* Walks the JPEG's segments up to the start of the image data, looking for APP1 with the "Exif" signature
+ * Only the headers are touched, so this costs next to nothing next to a decode
+ */
+bool findExifThumbnail(const uint8_t* data, const size_t size, const uint8_t** thumbnail, size_t* thumbnailSize) {
+    if (size < 4 || data[0] != 0xFF || data[1] != 0xD8)
+        return false;
+
+    size_t position = 2;
+    while (position + 4 <= size) {
+        if (data[position] != 0xFF)
+            return false;
+
+        uint8_t marker = data[position + 1];
+        if (marker == 0xFF) { // fill byte
+            position++;
+            continue;
+        }
+        if (marker == 0xDA || marker == 0xD9) // start of scan or end of image, so there's no EXIF
+            return false;
+
+        size_t length = (size_t)data[position + 2] << 8 | data[position + 3];
+        if (length < 2 || position + 2 + length > size)
+            return false;
+
+        const uint8_t* segment = data + position + 4;
+        size_t segmentSize = length - 2;
+        if (marker == 0xE1 && segmentSize >= 6 && memcmp(segment, "Exif\0\0", 6) == 0)
+            return findTiffThumbnail(segment + 6, segmentSize - 6, thumbnail, thumbnailSize);
+
+        position += 2 + length;
+    }
+
+    return false;
+}
@@ -0,0 +1,8 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+/* Finds the small JPEG most cameras embed in a photo's EXIF data (the APP1 segment), usually 160x120
+ * Nothing is decoded or copied, "thumbnail" points into "data"; false if the file has no EXIF thumbnail or it's malformed
+ */
+bool findExifThumbnail(const uint8_t* data, size_t size, const uint8_t** thumbnail, size_t* thumbnailSize);
@@ -0,0 +1,101 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include "planes.h"
+
+// the HSV hue of one pixel in degrees, for the paths that never have the pixels of a whole "image" (a brightness or scale applied to all three channels doesn't change it)
+// "planarHues" is the same formula over a tile at a time
+inline double hueDegrees(const double r, const double g, const double b) {
+	double max = std::max(r, std::max(g, b));
+	double delta = max - std::min(r, std::min(g, b));
+	if (delta < 0.00001)
+		return 0;
+
+	double hue = r >= max ? (g - b) / delta : g >= max ? 2.0 + (b - r) / delta : 4.0 + (r - g) / delta;
+	hue *= 60.0;
+	return hue < 0.0 ? hue + 360.0 : hue;
+}
+
+/* What each layout a decoder can hand back looks like: grey, grey + alpha, RGB and RGBA
+ * Decoders are asked for the file's own channels rather than forcing RGB, so the kernels below take whichever it is instead of the pixels being expanded to fit one
+ */
+template <int Channels>
+struct pixelLayout {
+	static_assert(Channels >= 1 && Channels <= 4, "pixels have 1 to 4 channels");
+	static constexpr bool colour = Channels >= 3;
+	static constexpr bool alpha = Channels == 2 || Channels == 4;
+};
+
+/* Calls "visit(tile, count, alpha)" for each tile of the pixels, split into planes and with their hues already worked out, see "pixelTile"
+ * Anything else worked out per pixel (see "featureAccumulator") reads the same tile, so it's all one pass over the image's memory
+ * Grey is copied into all three colour planes with a hue of 0, which is what "hueDegrees" and "planarHues" say for grey; "alpha" says whether the alpha plane was filled
+ * The tile lives on the stack, as it's only 16KB
+ */
+template <int Channels, typename VisitTile>
+void forEachTile(const uint8_t* pixels, const size_t count, VisitTile&& visit) {
+	typedef pixelLayout<Channels> layout;
+	pixelTile tile;
+	for (size_t start = 0; start < count; start += PLANE_TILE_PIXELS) {
+		const size_t run = std::min(count - start, (size_t)PLANE_TILE_PIXELS);
+		const uint8_t* from = pixels + start * Channels;
+		if constexpr (layout::colour) {
+			deinterleave(from, run, Channels, tile);
+			planarHues(tile, run);
+		}
+		else {
+			for (size_t i = 0; i < run; i++) {
+				tile.planes[0][i] = tile.planes[1][i] = tile.planes[2][i] = from[i * Channels];
+				if (layout::alpha)
+					tile.planes[3][i] = from[i * Channels + 1];
+				tile.hues[i] = 0.0f;
+			}
+		}
+		visit(static_cast<const pixelTile&>(tile), run, layout::alpha);
+	}
+}
+
+template <typename VisitTile>
+bool forEachTile(const int channels, const uint8_t* pixels, const size_t count, VisitTile&& visit) {
+	switch (channels) {
+	case 1: forEachTile<1>(pixels, count, visit); return true;
+	case 2: forEachTile<2>(pixels, count, visit); return true;
+	case 3: forEachTile<3>(pixels, count, visit); return true;
+	case 4: forEachTile<4>(pixels, count, visit); return true;
+	default: return false;
+	}
+}
+
+/* Calls "visit" with the hue of each pixel (as a float), for one layout chosen at compile time, so the loop has no per-pixel checks on the channel count
+ * Colour pixels go through "forEachTile", so their hues are worked out 4 at a time from planes
+ * Grey has no hue, so a grey pixel visits 0 without even being split into planes
+ * A fully transparent pixel isn't seen in the viewer, so it's skipped rather than counted as whatever colour happens to be stored under it
+ */
+template <int Channels, typename Visit>
+void forEachHue(const uint8_t* pixels, const size_t count, Visit&& visit) {
+	typedef pixelLayout<Channels> layout;
+	if constexpr (layout::colour) {
+		forEachTile<Channels>(pixels, count, [&visit](const pixelTile& tile, size_t run, bool) {
+			for (size_t i = 0; i < run; i++)
+				if (!layout::alpha || tile.planes[3][i] != 0)
+					visit(tile.hues[i]);
+		});
+	}
+	else {
+		for (size_t i = 0; i < count; i++, pixels += Channels)
+			if (!layout::alpha || pixels[Channels - 1] != 0)
+				visit(0.0f);
+	}
+}
+
+// picks the kernel for a channel count only known at run time, once per call rather than once per pixel; false if there's no kernel for it
+template <typename Visit>
+bool forEachHue(const int channels, const uint8_t* pixels, const size_t count, Visit&& visit) {
+	switch (channels) {
+	case 1: forEachHue<1>(pixels, count, visit); return true;
+	case 2: forEachHue<2>(pixels, count, visit); return true;
+	case 3: forEachHue<3>(pixels, count, visit); return true;
+	case 4: forEachHue<4>(pixels, count, visit); return true;
+	default: return false;
+	}
+}
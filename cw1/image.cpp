@@ -1,77 +1,119 @@
 #include "image.h"
+#include <algorithm>
 
-hsv image::rgb2hsv(const rgb in)
-{
-    hsv out;
-    double min, max, delta;
+// keep the aspect ratio and never upscale, so small images are stored as they are
+void downscaledSize(const unsigned int width, const unsigned int height, const unsigned int maxWidth, const unsigned int maxHeight, unsigned int* outWidth, unsigned int* outHeight) {
+    double scale = std::min(1.0, std::min(maxWidth / double(width), maxHeight / double(height)));
+    *outWidth = std::max(1u, (unsigned int)(width * scale));
+    *outHeight = std::max(1u, (unsigned int)(height * scale));
+}
 
-    min = in.r < in.g ? in.r : in.g;
-    min = min < in.b ? min : in.b;
+void image::calculateMedianHue() {
+    if (this->cached || this->imageData.empty()) // the hue of a cached image was restored along with it, and there's nothing to take a median of otherwise
+        return;
 
-    max = in.r > in.g ? in.r : in.g;
-    max = max > in.b ? max : in.b;
+    const pixelBuffer& imgData = this->imageData; // not a copy, that would double the memory an image takes while this runs
+    std::vector<float> HuesList = std::vector<float>(); // float rather than double halves what the median has to move around, and the hues are only float32 to begin with
+    HuesList.reserve((size_t)this->width * this->height);
 
-    out.v = max; // v
-    delta = max - min;
-    if (delta < 0.00001)
-    {
-        out.s = 0;
-        out.h = 0; // undefined, maybe nan?
-        return out;
-    }
-    if (max > 0.0) { // NOTE: if Max is == 0, this divide would cause a crash
-        out.s = (delta / max); // s
-    }
-    else {
-        // if max is 0, then r = g = b = 0              
-        // s = 0, h is undefined
-        out.s = 0.0;
-        out.h = NAN; // its now undefined
-        return out;
-    }
-    if (in.r >= max) // > is bogus, just keeps compilor happy
-        out.h = (in.g - in.b) / delta; // between yellow & magenta
-    else
-        if (in.g >= max)
-            out.h = 2.0 + (in.b - in.r) / delta; // between cyan & yellow
-        else
-            out.h = 4.0 + (in.r - in.g) / delta; // between magenta & cyan
+    /* This loop is very time consuming as there are a lot of pixels in each image
+     * However, there is no point parallelising it as that would mean we could only have one "image::calculateMedianHue()" thread running at a time to prevent CPU thrashing
+     * Therefore, in theory, if we did parallelise it, it would take just as long, if not longer to finish
+     * The pixels are whatever the decoder gave back (grey, grey + alpha, RGB or RGBA), and "forEachTile" steps through them with the right stride for each
+     * The rest of the image's features are counted from the same tiles, so they cost no extra pass over the pixels
+     */
+    featureAccumulator accumulator;
+    bool known = forEachTile(this->channels, imgData.data(), (size_t)this->width * this->height, [&HuesList, &accumulator](const pixelTile& tile, size_t count, bool alpha) {
+        for (size_t i = 0; i < count; i++)
+            if (!alpha || tile.planes[3][i] != 0)
+                HuesList.push_back(tile.hues[i]);
+        accumulator.add(tile, count, alpha);
+    });
+    if (!known)
+        return;
+    this->features = accumulator.finish();
 
-    out.h *= 60.0; // degrees
+    size_t size = HuesList.size();
+    if (size == 0) // every pixel was transparent
+        return;
 
-    if (out.h < 0.0)
-        out.h += 360.0;
+    // only the middle one or two hues matter, so they're found in linear time rather than sorting every pixel's hue
+    std::nth_element(HuesList.begin(), HuesList.begin() + size / 2, HuesList.end());
+    double upper = HuesList[size / 2];
+    double medianHue = size % 2 ? upper : (upper + *std::max_element(HuesList.begin(), HuesList.begin() + size / 2)) / 2;
 
-    return out;
+    this->medianHue = medianHue;
 }
 
-void image::calculateMedianHue() {
-    std::vector<uint8_t> imgData = this->getImageData();
-    std::vector<double> HuesList = std::vector<double>();
+/* For when the hue came from somewhere other than the pixels (e.g. the JPEG's chroma planes), so there was no pass to count the features in
+ * They come from the preview instead, which is a small fraction of the pixels and looks the same at a glance, which is all a sort by them needs
+ */
+void image::estimateFeatures() {
+    std::shared_ptr<const bitmap> from = this->preview ? this->preview : this->thumbnail;
+    if (!from || from->pixels.empty())
+        return;
 
-    /* This for loop is very time consuming as there are a lot of pixels in each image
-     * However, there is no point parallelising it as that would mean we could only have one "image::calculateMedianHue()" thread running at a time to prevent CPU thrashing
-     * Therefore, in theory, if we did parallelise it, it would take just as long, if not longer to finish
+    featureAccumulator accumulator;
+    forEachTile<4>(from->pixels.data(), (size_t)from->width * from->height, [&accumulator](const pixelTile& tile, size_t count, bool alpha) { accumulator.add(tile, count, alpha); });
+    this->features = accumulator.finish();
+}
+
+double image::getMedianHue() const {
+    double intpart;
+    return this->medianHue == 0 ? 0.0 : modf((this->medianHue / 360 + 1 / 6), &intpart);
+}
+
+bitmap image::downscale(const unsigned int maxWidth, const unsigned int maxHeight) const {
+    bitmap out = { std::vector<uint8_t>(), 0, 0 };
+    if (this->imageData.empty() || this->width <= 0 || this->height <= 0)
+        return out;
+
+    downscaledSize(this->width, this->height, maxWidth, maxHeight, &out.width, &out.height);
+    out.pixels.resize(out.width * out.height * 4);
+
+    /* Box filter: each output pixel is the average of the block of source pixels it covers
+     * This is a lot better looking than nearest-neighbour at thumbnail sizes, and it's only done once per image as the result is stored
      */
-    for (unsigned int i = 0; i < imgData.size(); i += 3) {
-        rgb pixelRGB;
+    for (unsigned int y = 0; y < out.height; y++) {
+        unsigned int y0 = (unsigned int)(y * (uint64_t)this->height / out.height);
+        unsigned int y1 = std::max(y0 + 1, (unsigned int)((y + 1) * (uint64_t)this->height / out.height));
+
+        for (unsigned int x = 0; x < out.width; x++) {
+            unsigned int x0 = (unsigned int)(x * (uint64_t)this->width / out.width);
+            unsigned int x1 = std::max(x0 + 1, (unsigned int)((x + 1) * (uint64_t)this->width / out.width));
 
-        pixelRGB.r = imgData[i];
-        pixelRGB.g = imgData[i + 1];
-        pixelRGB.b = imgData[i + 2];
+            uint64_t sum[4] = { 0, 0, 0, 0 };
+            for (unsigned int sy = y0; sy < y1; sy++) {
+                const uint8_t* row = &this->imageData[((size_t)sy * this->width + x0) * this->channels];
+                for (unsigned int sx = x0; sx < x1; sx++, row += this->channels)
+                    for (int c = 0; c < this->channels; c++)
+                        sum[c] += row[c];
+            }
 
-        HuesList.push_back(rgb2hsv(pixelRGB).h);
+            uint64_t count = (uint64_t)(y1 - y0) * (x1 - x0);
+            uint8_t* dst = &out.pixels[((size_t)y * out.width + x) * 4];
+            if (this->channels < 3) { // grey (and grey + alpha) is spread across all three colour channels
+                dst[0] = dst[1] = dst[2] = (uint8_t)(sum[0] / count);
+                dst[3] = this->channels == 2 ? (uint8_t)(sum[1] / count) : 255;
+            }
+            else {
+                dst[0] = (uint8_t)(sum[0] / count);
+                dst[1] = (uint8_t)(sum[1] / count);
+                dst[2] = (uint8_t)(sum[2] / count);
+                dst[3] = this->channels == 4 ? (uint8_t)(sum[3] / count) : 255;
+            }
+        }
     }
 
-    std::sort(HuesList.begin(), HuesList.end(), [](double a, double b) { return a > b; });
-    
-    size_t size = HuesList.size();
-    double medianHue = size % 2 ? HuesList[size / 2] : (HuesList[size / 2] + HuesList[size / 2 - 1]) / 2;
+    return out;
+}
 
-    this->medianHue = medianHue;
+// on its own for images only loaded from their EXIF thumbnail, which is far too small to make a preview from
+void image::generateThumbnail() {
+    this->thumbnail = std::make_shared<const bitmap>(this->downscale(THUMBNAIL_WIDTH, THUMBNAIL_HEIGHT));
 }
 
-double image::getMedianHue() {
-    double intpart;
-    return this->medianHue == 0 ? NULL : modf((this->medianHue / 360 + 1 / 6), &intpart);
+void image::generatePreviews() {
+    this->generateThumbnail();
+    this->preview = std::make_shared<const bitmap>(this->downscale(PREVIEW_WIDTH, PREVIEW_HEIGHT));
 }
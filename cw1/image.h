@@ -1,35 +1,65 @@
+#pragma once
+#include <memory>
 #include <mutex>
 #include <string>
 #include <vector>
 #include <math.h>
 #include <iostream>
 #include <SFML/Graphics.hpp>
+#include "bufferpool.h"
+#include "imagefeatures.h"
+#include "hue.h"
 
-typedef struct {
-	double r; // a fraction between 0 and 1
-	double g; // a fraction between 0 and 1
-	double b; // a fraction between 0 and 1
-} rgb;
+// sizes of the copies kept in the thumbnail store; the preview matches the viewer's window so it can be shown without rescaling
+#define THUMBNAIL_WIDTH 160
+#define THUMBNAIL_HEIGHT 120
+#define PREVIEW_WIDTH 800
+#define PREVIEW_HEIGHT 600
 
 typedef struct {
-	double h; // angle in degrees
-	double s; // a fraction between 0 and 1
-	double v; // a fraction between 0 and 1
-} hsv;
+	std::vector<uint8_t> pixels; // RGBA, which is what "sf::Texture::update" expects
+	unsigned int width;
+	unsigned int height;
+} bitmap;
+
+void downscaledSize(unsigned int width, unsigned int height, unsigned int maxWidth, unsigned int maxHeight, unsigned int* outWidth, unsigned int* outHeight);
 
 class image
 {
 private:
 	std::string path;
-	std::vector<uint8_t> imageData;
+	pixelBuffer imageData; // recycled through "pixelBuffers" rather than freed, as it's the same few MB for every image
+	int width = 0;
+	int height = 0;
+	int channels = 0;
 	double medianHue = 0;
-	hsv rgb2hsv(rgb in);
+	imageFeatures features = {}; // worked out alongside the median hue, see "calculateMedianHue"
+	bool cached = false; // true if this image was restored from the thumbnail store, in which case there is no "imageData"
+	size_t id = 0; // the image's id in the catalog
+	std::shared_ptr<const bitmap> thumbnail; // shared with the catalog, so the viewer can show it without touching this object
+	std::shared_ptr<const bitmap> preview;
 public:
-	image(std::string _path, std::vector<uint8_t> _imageData) : path(_path), imageData(_imageData) {}
+	image(std::string _path, pixelBuffer _imageData, int _width, int _height, int _channels) : path(_path), imageData(std::move(_imageData)), width(_width), height(_height), channels(_channels) {}
+	image(std::string _path, double _medianHue) : path(_path), medianHue(_medianHue), cached(true) {}
 	~image() = default;
 	[[nodiscard]] std::string getPath() const { return path; }
-	[[nodiscard]] std::vector<uint8_t> getImageData() const { return imageData; }
-	[[nodiscard]] double getMedianHue();
+	[[nodiscard]] const pixelBuffer& getImageData() const { return imageData; }
+	[[nodiscard]] double getMedianHue() const;
+	[[nodiscard]] double getHueDegrees() const { return medianHue; }
+	void setHueDegrees(double hue) { medianHue = hue; }
+	[[nodiscard]] const imageFeatures& getFeatures() const { return features; }
+	void setFeatures(const imageFeatures& _features) { features = _features; }
+	[[nodiscard]] bool isCached() const { return cached; }
+	[[nodiscard]] size_t getId() const { return id; }
+	void setId(size_t _id) { id = _id; }
+	[[nodiscard]] std::shared_ptr<const bitmap> getThumbnail() const { return thumbnail; }
+	[[nodiscard]] std::shared_ptr<const bitmap> getPreview() const { return preview; }
+	[[nodiscard]] bitmap downscale(unsigned int maxWidth, unsigned int maxHeight) const;
 	void calculateMedianHue();
+	void estimateFeatures();
+	void generateThumbnail();
+	void generatePreviews();
+	void setPreviews(std::shared_ptr<const bitmap> _thumbnail, std::shared_ptr<const bitmap> _preview) { thumbnail = _thumbnail; preview = _preview; }
+	// once the hue and previews are made the full-size pixels aren't needed again, and they're by far the biggest part of an image
+	void releasePixels() { pixelBuffer().swap(imageData); }
 };
-
@@ -0,0 +1,149 @@
+#include "imagefeatures.h"
+#include <algorithm>
+#include <cmath>
+
+#define COLOUR_CELLS (1 << (3 * FEATURE_COLOUR_BITS))
+#define DOMINANT_CELLS (1 << (3 * FEATURE_DOMINANT_BITS))
+
+// 65536 * 255 / max, so a saturation is a multiply and a shift rather than a divide per pixel
+static const uint32_t* saturationScale() {
+    static const std::vector<uint32_t> table = []() {
+        std::vector<uint32_t> built(256, 0);
+        for (uint32_t max = 1; max < 256; max++)
+            built[max] = (65536u * 255u + max / 2) / max;
+        return built;
+    }();
+    return table.data();
+}
+
+static double labCurve(const double t) {
+    return t > 216.0 / 24389.0 ? cbrt(t) : (24389.0 / 27.0 * t + 16.0) / 116.0;
+}
+
+// sRGB (0-255) to CIELAB against the D65 white point
+static void rgbToLab(const double r, const double g, const double b, double lab[3]) {
+    double lr = srgbToLinear(r), lg = srgbToLinear(g), lb = srgbToLinear(b);
+    double x = (0.4124564 * lr + 0.3575761 * lg + 0.1804375 * lb) / 0.95047;
+    double y = 0.2126729 * lr + 0.7151522 * lg + 0.0721750 * lb;
+    double z = (0.0193339 * lr + 0.1191920 * lg + 0.9503041 * lb) / 1.08883;
+    double fx = labCurve(x), fy = labCurve(y), fz = labCurve(z);
+    lab[0] = 116.0 * fy - 16.0;
+    lab[1] = 500.0 * (fx - fy);
+    lab[2] = 200.0 * (fy - fz);
+}
+
+// the value at the middle of a 256 bin histogram of "total" values
+static uint8_t histogramMedian(const uint64_t* counts, const uint64_t total) {
+    const uint64_t middle = total / 2;
+    uint64_t seen = 0;
+    for (int i = 0; i < 256; i++) {
+        seen += counts[i];
+        if (seen > middle)
+            return (uint8_t)i;
+    }
+    return 255;
+}
+
+static bool perceptualEnabled = false;
+
+void setPerceptualFeatures(const bool enabled) {
+    perceptualEnabled = enabled;
+}
+
+bool perceptualFeatures() {
+    return perceptualEnabled;
+}
+
+featureAccumulator::featureAccumulator() : colourCounts(COLOUR_CELLS, 0), colourSums((size_t)COLOUR_CELLS * 3, 0), perceptualWanted(perceptualFeatures()) {}
+
+void featureAccumulator::add(const pixelTile& tile, const size_t count, const bool alpha) {
+    const uint32_t* scale = saturationScale();
+    const int shift = 8 - FEATURE_COLOUR_BITS;
+
+    for (size_t i = 0; i < count; i++) {
+        if (alpha && tile.planes[3][i] == 0) // transparent pixels don't count, the same as for the hue
+            continue;
+
+        const uint32_t r = tile.planes[0][i], g = tile.planes[1][i], b = tile.planes[2][i];
+        const uint32_t max = std::max(r, std::max(g, b));
+        const uint32_t delta = max - std::min(r, std::min(g, b));
+
+        this->valueCounts[max]++;
+        this->saturationCounts[std::min(255u, (delta * scale[max] + 32768) >> 16)]++;
+        // grey has no hue, so it's left out of the hue histogram rather than all piling into the first bin
+        if (delta != 0)
+            this->hueCounts[std::min(FEATURE_HUE_BINS - 1, (int)(tile.hues[i] * (FEATURE_HUE_BINS / 360.0f)))]++;
+
+        const size_t cell = (size_t)(r >> shift) << (2 * FEATURE_COLOUR_BITS) | (size_t)(g >> shift) << FEATURE_COLOUR_BITS | (b >> shift);
+        this->colourCounts[cell]++;
+        this->colourSums[cell * 3] += r;
+        this->colourSums[cell * 3 + 1] += g;
+        this->colourSums[cell * 3 + 2] += b;
+
+        const int64_t rg = (int64_t)r - g, yb = (int64_t)r + g - 2 * (int64_t)b;
+        this->redGreen += rg;
+        this->redGreenSquares += rg * rg;
+        this->yellowBlue += yb;
+        this->yellowBlueSquares += yb * yb;
+        this->pixels++;
+    }
+    if (this->perceptualWanted)
+        this->perceptual.add(tile, count, alpha);
+}
+
+imageFeatures featureAccumulator::finish() const {
+    imageFeatures out = {};
+    out.known = 1;
+    if (this->perceptualWanted)
+        this->perceptual.finish(&out.perceptualHue, &out.perceptualLightness);
+    else
+        out.perceptualHue = out.perceptualLightness = -1.0f;
+    if (this->pixels == 0)
+        return out;
+
+    uint64_t coloured = 0;
+    for (int i = 0; i < FEATURE_HUE_BINS; i++)
+        coloured += this->hueCounts[i];
+    for (int i = 0; i < FEATURE_HUE_BINS && coloured > 0; i++)
+        out.hueHistogram[i] = (uint16_t)((this->hueCounts[i] * 65535 + coloured / 2) / coloured);
+
+    out.medianSaturation = histogramMedian(this->saturationCounts, this->pixels);
+    out.medianValue = histogramMedian(this->valueCounts, this->pixels);
+
+    // each cell's mean colour stands in for its pixels; a cell is 16 levels wide, which moves the mean by well under one unit of Lab
+    double labSums[3] = { 0, 0, 0 };
+    std::vector<uint64_t> dominantCounts(DOMINANT_CELLS, 0);
+    std::vector<uint64_t> dominantSums((size_t)DOMINANT_CELLS * 3, 0);
+    const int merge = FEATURE_COLOUR_BITS - FEATURE_DOMINANT_BITS;
+    const size_t cellMask = (1 << FEATURE_COLOUR_BITS) - 1;
+    for (size_t cell = 0; cell < COLOUR_CELLS; cell++) {
+        const uint32_t n = this->colourCounts[cell];
+        if (n == 0)
+            continue;
+
+        double lab[3];
+        rgbToLab(this->colourSums[cell * 3] / (double)n, this->colourSums[cell * 3 + 1] / (double)n, this->colourSums[cell * 3 + 2] / (double)n, lab);
+        for (int c = 0; c < 3; c++)
+            labSums[c] += lab[c] * n;
+
+        size_t r = cell >> (2 * FEATURE_COLOUR_BITS), g = (cell >> FEATURE_COLOUR_BITS) & cellMask, b = cell & cellMask;
+        size_t merged = (r >> merge) << (2 * FEATURE_DOMINANT_BITS) | (g >> merge) << FEATURE_DOMINANT_BITS | (b >> merge);
+        dominantCounts[merged] += n;
+        for (int c = 0; c < 3; c++)
+            dominantSums[merged * 3 + c] += this->colourSums[cell * 3 + c];
+    }
+    for (int c = 0; c < 3; c++)
+        out.meanLab[c] = (float)(labSums[c] / this->pixels);
+
+    size_t dominant = std::max_element(dominantCounts.begin(), dominantCounts.end()) - dominantCounts.begin();
+    for (int c = 0; c < 3; c++)
+        out.dominant[c] = (uint8_t)((dominantSums[dominant * 3 + c] + dominantCounts[dominant] / 2) / dominantCounts[dominant]);
+
+    // M = sqrt(sd(rg)^2 + sd(yb)^2) + 0.3 * sqrt(mean(rg)^2 + mean(yb)^2), with yb halved back to Hasler and Suesstrunk's scale
+    const double n = (double)this->pixels;
+    double meanRg = this->redGreen / n, meanYb = this->yellowBlue / n / 2.0;
+    double varianceRg = std::max(0.0, this->redGreenSquares / n - meanRg * meanRg);
+    double varianceYb = std::max(0.0, this->yellowBlueSquares / n / 4.0 - meanYb * meanYb);
+    out.colourfulness = (float)(sqrt(varianceRg + varianceYb) + 0.3 * sqrt(meanRg * meanRg + meanYb * meanYb));
+    return out;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "oklab.h"
+#include "planes.h"
+
+// 15 degrees per bin, enough to tell apart e.g. orange from yellow without the record growing much
+#define FEATURE_HUE_BINS 24
+// the colour cube is 16 x 16 x 16 for the Lab mean, and merged down to 8 x 8 x 8 to pick the dominant colour
+#define FEATURE_COLOUR_BITS 4
+#define FEATURE_DOMINANT_BITS 3
+
+/* Everything worked out about an image besides its median hue, in the same pass over the pixels as the hue
+ * Kept with the image, in the catalog and in the thumbnail store, so sorting by another of these never has to look at the pixels again
+ * Plain data with no pointers, so the store can write it as it is
+ */
+typedef struct {
+	uint16_t hueHistogram[FEATURE_HUE_BINS]; // share of the coloured (non-grey) pixels in each bin, out of 65535
+	float meanLab[3]; // CIELAB (D65) L*, a*, b*
+	float colourfulness; // Hasler and Suesstrunk's M, about 0 for grey and over 100 for very vivid images
+	float perceptualHue; // the median OKLab hue angle in degrees, negative for a (nearly) neutral image, see "perceptualAccumulator"
+	float perceptualLightness; // the median OKLab L, 0-1; negative if the OKLab features weren't worked out, see "setPerceptualFeatures"
+	uint8_t medianSaturation; // 0-255, as HSV's s * 255
+	uint8_t medianValue; // 0-255, the brightest channel
+	uint8_t dominant[3]; // RGB, the mean of the most common colour
+	uint8_t known; // 0 until the features have been worked out
+} imageFeatures;
+
+/* Whether "featureAccumulator" works out the OKLab hue and lightness too ("--perceptual-hue"), which only the perceptual sort key uses
+ * Off unless asked for, as the OKLab conversion costs more than the rest of the features put together; it's set at startup before any image is loaded, so it isn't locked
+ */
+void setPerceptualFeatures(bool enabled);
+[[nodiscard]] bool perceptualFeatures();
+
+/* Builds up an "imageFeatures" from tiles of planar pixels as the hue kernels go through them, see "forEachTile"
+ * Besides the OKLab conversion for "perceptualAccumulator", the per-pixel work is all integer counting; the medians come from histograms and Lab from the colour cube, so nothing is kept per pixel
+ */
+class featureAccumulator
+{
+private:
+	uint64_t hueCounts[FEATURE_HUE_BINS] = {};
+	uint64_t saturationCounts[256] = {};
+	uint64_t valueCounts[256] = {};
+	std::vector<uint32_t> colourCounts; // per cell of the colour cube
+	std::vector<uint64_t> colourSums; // R, G and B per cell, so a cell's colour is its mean rather than its centre
+	int64_t redGreen = 0; // R - G, summed
+	int64_t redGreenSquares = 0;
+	int64_t yellowBlue = 0; // R + G - 2B, which is twice Hasler and Suesstrunk's so it stays an integer
+	int64_t yellowBlueSquares = 0;
+	uint64_t pixels = 0;
+	bool perceptualWanted; // "perceptualFeatures" when this was made
+	perceptualAccumulator perceptual;
+public:
+	featureAccumulator();
+	void add(const pixelTile& tile, size_t count, bool alpha);
+	[[nodiscard]] imageFeatures finish() const;
+};
@@ -0,0 +1,233 @@
+#include "io.h"
+#include <filesystem>
+#include <fstream>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+/* Reads a whole file in one go
+ * On Linux the kernel is told the file will be read sequentially, which doubles how far it reads ahead within it
+ */
+bool readFile(const std::string& path, std::vector<uint8_t>& out) {
+#ifdef __linux__
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    out.resize((size_t)st.st_size);
+    size_t done = 0;
+    while (done < out.size()) {
+        ssize_t bytes = ::read(fd, out.data() + done, out.size() - done);
+        if (bytes <= 0)
+            break;
+        done += (size_t)bytes;
+    }
+    close(fd);
+
+    out.resize(done);
+    return done > 0;
+#else
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file.is_open())
+        return false;
+
+    std::streamsize size = file.tellg();
+    file.seekg(0, std::ios::beg);
+    out.resize((size_t)size);
+    if (!file.read(reinterpret_cast<char*>(out.data()), size))
+        return false;
+    return size > 0;
+#endif
+}
+
+/* Asks the kernel to start reading a file into the page cache without waiting for it, so it's there by the time "readFile" gets to it
+ * "WILLNEED" queues the reads and returns; they carry on after the descriptor is closed
+ */
+static void prefetchFile(const std::string& path) {
+#ifdef __linux__
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    close(fd);
+#else
+    (void)path;
+#endif
+}
+
+/* A number to sort files by so that reading them in order moves across the disk in one direction
+ * For "extent" this asks the filesystem for the physical offset of the file's first block, which is only an "ioctl" on an inode the scan has just brought into the cache
+ * Anything that can't say (no "FIEMAP" support, an empty file, another platform) falls back to the inode number
+ */
+uint64_t physicalLocation(const std::string& path, const uint64_t inode, const readOrder order) {
+#ifdef __linux__
+    if (order != readOrder::extent)
+        return inode;
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return inode;
+
+    // room for the header and exactly one extent, the first is all that's needed
+    alignas(struct fiemap) char buffer[sizeof(struct fiemap) + sizeof(struct fiemap_extent)] = { 0 };
+    struct fiemap* map = reinterpret_cast<struct fiemap*>(buffer);
+    map->fm_start = 0;
+    map->fm_length = FIEMAP_MAX_OFFSET;
+    map->fm_extent_count = 1;
+
+    uint64_t location = inode;
+    if (ioctl(fd, FS_IOC_FIEMAP, map) == 0 && map->fm_mapped_extents > 0)
+        location = map->fm_extents[0].fe_physical;
+    close(fd);
+
+    return location;
+#else
+    return inode;
+#endif
+}
+
+fileReader::fileReader(const unsigned int threads, const uint64_t _maxBytesInFlight, const readOrder _order, std::function<void(const std::string&, std::shared_ptr<std::vector<uint8_t>>, double)> _onRead) : onRead(_onRead), order(_order), maxBytesInFlight(_maxBytesInFlight) {
+    for (unsigned int i = 0; i < threads; i++)
+        this->readers.push_back(std::thread(&fileReader::readThread, this));
+}
+
+fileReader::~fileReader() {
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        this->stopping = true;
+    }
+    this->requestAvailable.notify_all();
+
+    for (std::thread& t : this->readers)
+        t.join();
+}
+
+bool fileReader::hasRequests() const {
+    return !this->requests.empty() || !this->requestsByLocation.empty();
+}
+
+/* For the physical orders this is an elevator that only goes one way: the nearest file at or past the last read, wrapping to the start of the disk at the end
+ * Files found by the scan while the sweep is underway are simply picked up the next time it passes them
+ */
+fileReader::request fileReader::nextRequest() {
+    if (this->order == readOrder::largestFirst) {
+        request next = this->requests.top();
+        this->requests.pop();
+        return next;
+    }
+
+    auto next = this->requestsByLocation.lower_bound(this->headLocation);
+    if (next == this->requestsByLocation.end())
+        next = this->requestsByLocation.begin();
+
+    this->headLocation = next->first;
+    request nextRequest = std::move(next->second);
+    this->requestsByLocation.erase(next);
+    return nextRequest;
+}
+
+// the path "nextRequest" would hand out now, or an empty string if nothing is queued
+std::string fileReader::upcomingPath() const {
+    if (this->order == readOrder::largestFirst)
+        return this->requests.empty() ? std::string() : this->requests.top().path;
+
+    if (this->requestsByLocation.empty())
+        return std::string();
+    auto next = this->requestsByLocation.lower_bound(this->headLocation);
+    return (next == this->requestsByLocation.end() ? this->requestsByLocation.begin() : next)->second.path;
+}
+
+void fileReader::readThread() {
+    std::unique_lock<std::mutex> lock(mut);
+
+    while (true) {
+        this->requestAvailable.wait(lock, [this]() { return this->stopping || this->hasRequests(); });
+        if (!this->hasRequests())
+            return;
+
+        request next = this->nextRequest();
+        std::string upcoming = this->upcomingPath();
+        this->reading++;
+
+        /* Blocks while the decoders are too far behind; the size comes from the directory entry's metadata, which is cheap to get
+         * A file bigger than the whole budget is still read once nothing else is in flight, otherwise it would never be read at all
+         */
+        lock.unlock();
+        std::error_code ec;
+        uint64_t size = fs::file_size(next.path, ec);
+        if (ec)
+            size = 0;
+        lock.lock();
+
+        this->budgetAvailable.wait(lock, [this, size]() { return this->bytesInFlight == 0 || this->bytesInFlight + size <= this->maxBytesInFlight; });
+        this->bytesInFlight += size;
+
+        // the file after this one is fetched while this one is read, so the disk always has the next read queued when this one finishes
+        lock.unlock();
+        if (!upcoming.empty())
+            prefetchFile(upcoming);
+        std::shared_ptr<std::vector<uint8_t>> data = std::make_shared<std::vector<uint8_t>>();
+        bool read = readFile(next.path, *data);
+        lock.lock();
+
+        // the budget is charged for what was actually read, which the decoder gives back through "release"
+        this->bytesInFlight -= size;
+        if (read)
+            this->bytesInFlight += data->size();
+        else
+            this->budgetAvailable.notify_all();
+
+        lock.unlock();
+        if (read)
+            this->onRead(next.path, data, next.cost);
+        lock.lock();
+
+        this->reading--;
+        if (!this->hasRequests() && this->reading == 0)
+            this->idle.notify_all();
+    }
+}
+
+void fileReader::submit(const std::string& path, const double cost, const uint64_t inode) {
+    // worked out before taking the lock, as for "extent" it's a system call
+    uint64_t location = this->order == readOrder::largestFirst ? 0 : physicalLocation(path, inode, this->order);
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        if (this->order == readOrder::largestFirst)
+            this->requests.push({ cost, this->submitted++, path });
+        else
+            this->requestsByLocation.insert({ location, { cost, this->submitted++, path } });
+    }
+    this->requestAvailable.notify_one();
+}
+
+// called once the bytes of a file that was read are no longer needed
+void fileReader::release(const uint64_t bytes) {
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        this->bytesInFlight -= bytes;
+    }
+    this->budgetAvailable.notify_all();
+}
+
+// blocks until every file submitted so far has been read and handed over
+void fileReader::wait() {
+    std::unique_lock<std::mutex> lock(mut);
+    this->idle.wait(lock, [this]() { return !this->hasRequests() && this->reading == 0; });
+}
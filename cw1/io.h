@@ -0,0 +1,71 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+// the default cap on file bytes that have been read but not yet decoded
+#define IO_BYTES_IN_FLIGHT (256ull * 1024 * 1024)
+
+/* The order the reader takes queued files in
+ * "largestFirst" matches the decoders' order, which is best when reads are cheap (an SSD, or a warm cache)
+ * On a spinning disk seeking dominates, so "inode" and "extent" sweep across the disk instead: by inode number (files are usually allocated near their inode), or by where "FIEMAP" says the file's data starts
+ */
+enum class readOrder { largestFirst, inode, extent };
+
+bool readFile(const std::string& path, std::vector<uint8_t>& out);
+uint64_t physicalLocation(const std::string& path, uint64_t inode, readOrder order);
+
+/* Reads whole files into memory on its own threads, ahead of the decode workers
+ * Decoding used to block on a synchronous read in every worker, so on a cold cache (or a network disk) cores sat idle waiting for I/O
+ * Here a few I/O threads keep several reads outstanding at the device, and a decode task is only queued once its file is in memory
+ * The number of bytes read but not yet released by the decoders is capped, so reading can't run away from decoding and fill memory
+ */
+class fileReader
+{
+private:
+	typedef struct {
+		double cost;
+		uint64_t sequence;
+		std::string path;
+	} request;
+
+	struct cheaperRequest {
+		bool operator()(const request& a, const request& b) const { return a.cost < b.cost || (a.cost == b.cost && a.sequence > b.sequence); }
+	};
+
+	std::function<void(const std::string&, std::shared_ptr<std::vector<uint8_t>>, double)> onRead;
+	std::vector<std::thread> readers;
+	readOrder order;
+	std::priority_queue<request, std::vector<request>, cheaperRequest> requests; // read in the same largest-first order the decoders will want them
+	std::multimap<uint64_t, request> requestsByLocation; // or, for the physical orders, by where they are on the disk
+	uint64_t headLocation = 0; // where the last read started, the sweep carries on from here
+	uint64_t submitted = 0;
+	size_t reading = 0;
+	uint64_t maxBytesInFlight;
+	uint64_t bytesInFlight = 0;
+	bool stopping = false;
+	std::mutex mut;
+	std::condition_variable requestAvailable;
+	std::condition_variable budgetAvailable;
+	std::condition_variable idle;
+
+	void readThread();
+	bool hasRequests() const;
+	request nextRequest();
+	std::string upcomingPath() const;
+public:
+	fileReader(unsigned int threads, uint64_t _maxBytesInFlight, readOrder _order, std::function<void(const std::string&, std::shared_ptr<std::vector<uint8_t>>, double)> _onRead);
+	~fileReader();
+	fileReader(const fileReader&) = delete;
+	fileReader& operator=(const fileReader&) = delete;
+	void submit(const std::string& path, double cost, uint64_t inode = 0);
+	void release(uint64_t bytes);
+	void wait();
+};
@@ -11,13 +11,41 @@
 #include <chrono>
 #include <fstream>
 #include "image.h"
-
+#include "catalog.h"
+#include "thumbnails.h"
+#include "viewer.h"
+#include "benchmark.h"
+#include "pool.h"
+#include "scanner.h"
+#include "io.h"
+#include "budget.h"
+#include "bufferpool.h"
+#include "decoder.h"
+#include "exif.h"
+#include "analysis.h"
+#include "restart.h"
+
+// stb's buffers are recycled through the same pool as the images' own, so decoding one image after another doesn't keep going back to the OS
+#define STBI_MALLOC(size) pixelBuffers().allocate(size)
+#define STBI_REALLOC(block, size) pixelBuffers().reallocate(block, size)
+#define STBI_FREE(block) pixelBuffers().free(block)
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
-// example folder to load images
+// example folder to load images, used when no folders are given on the command line
 #define IMAGES_DIRECTORY "C:\\Users\\taylo\\source\\repos\\taylorc1009\\Image-Fever\\unsorted"
 #define PLACEHOLDER_IMAGE "C:\\Users\\taylo\\source\\repos\\taylorc1009\\Image-Fever\\placeholder.jpg"
+// packed thumbnails/previews/hues from previous runs, written next to "times.csv"
+#define THUMBNAIL_STORE "thumbnails.bin"
+// threads only reading files, ahead of the decoders, in "largestFirst" order; each one is an outstanding read at the disk, so slow or network storage can want more
+#define IO_THREADS 4
+
+// the limits given on the command line for "t_loadImages"
+typedef struct {
+    uint64_t readAheadBytes; // file data read but not yet decoded
+    readOrder order;
+    uint64_t decodeBytes; // decoded pixels alive at once
+} loadSettings;
 
 namespace fs = std::filesystem;
 
@@ -42,27 +70,277 @@ void outputTimes(std::shared_ptr<std::vector<std::chrono::milliseconds>> times)
         std::cout << "(!) failed to open/create CSV file" << std::endl;
 }
 
-void loadImageData(std::shared_ptr<std::vector<image>> images, std::string path)
+// kept out of "times.csv" as the UI thread measures these while the other threads are still writing to "times"
+void outputStartupTimes(std::chrono::milliseconds timeToPlaceholder, std::chrono::milliseconds timeToFirstImage) {
+    std::ofstream csv;
+    csv.open("startup.csv");
+
+    if (csv.is_open()) {
+        csv << "placeholder," << timeToPlaceholder.count() << '\n' << "first image," << timeToFirstImage.count() << '\n';
+        csv.close();
+    }
+    else
+        std::cout << "(!) failed to open/create CSV file" << std::endl;
+}
+
+/* A cheap estimate of how long "loadImageData" will take for a file, used to schedule the biggest images first
+ * "stbi_info" only reads the header (for a JPEG, up to the frame header), and decode plus hue time is roughly proportional to the number of pixels
+ * The constant stands for the per-file work that doesn't depend on size (opening it, the thumbnail store, the catalog)
+ */
+double estimateDecodeCost(const std::string& path) {
+    int width, height, n;
+    if (!stbi_info(path.c_str(), &width, &height, &n))
+        return 0; // it won't decode either, so it may as well fail last
+
+    return (double)width * height + 65536.0;
+}
+
+// the same estimate from a file that's already been read, for the physical read orders which don't probe headers before the sweep
+double estimateDecodeCost(const std::vector<uint8_t>& fileData) {
+    int width, height, n;
+    std::string error;
+    if (!decoders().info(fileData.data(), fileData.size(), &width, &height, &n, &error))
+        return 0;
+
+    return (double)width * height + 65536.0;
+}
+
+// if the store has this exact file (same path, size and modification time) then its hue is already known, so there's no need to read or decode it at all
+bool loadCachedImage(std::shared_ptr<std::vector<image>> images, std::shared_ptr<catalog> cat, std::shared_ptr<thumbnailStore> store, const std::string& path) {
+    double medianHue;
+    imageFeatures features;
+    if (!store->lookupHue(makeFileKey(path), &medianHue, &features))
+        return false;
+    // stored by a run without "--perceptual-hue", so it's decoded again for the OKLab features this run wants
+    if (perceptualFeatures() && features.perceptualLightness < 0)
+        return false;
+
+    image img(path, medianHue);
+    img.setFeatures(features);
+    img.setId(cat->add(path, medianHue, features, nullptr, nullptr));
+
+    std::lock_guard<std::mutex> lock(mut);
+    images->push_back(std::move(img));
+    return true;
+}
+
+/* The most memory decoding an image holds at once: stb's buffer alongside the image's own copy of the pixels, or later the pixels alongside "calculateMedianHue"'s list of hues (a float per pixel)
+ */
+uint64_t decodeFootprint(int width, int height, int channels) {
+    uint64_t pixels = (uint64_t)width * height;
+    return std::max(pixels * channels * 2, pixels * channels + pixels * sizeof(float));
+}
+
+/* The "--exif-thumbnails" fast path: the hue and thumbnail come from the small JPEG a camera embeds in the EXIF data, and the photo itself is never decoded
+ * There's no preview to show, so the viewer decodes the file when it's opened; by then the rest of the images have long been sorted
+ * False if there's no usable EXIF thumbnail, in which case the file is decoded as normal
+ */
+bool loadExifImage(std::shared_ptr<std::vector<image>> images, std::shared_ptr<catalog> cat, std::string path, const std::vector<uint8_t>& fileData, bool calculateHue) {
+    const uint8_t* thumbnailData;
+    size_t thumbnailSize;
+    if (!findExifThumbnail(fileData.data(), fileData.size(), &thumbnailData, &thumbnailSize))
+        return false;
+
+    // with "--chroma-hue" the embedded JPEG's hue and thumbnail come from the one raw pass over its planes, as for a full-size one in "loadChromaImage"
+    double medianHue;
+    ycbcrPreviews previews;
+    if (calculateHue && decoders().medianHue(thumbnailData, thumbnailSize, &medianHue, &previews)) {
+        image img(path, pixelBuffer(), previews.getWidth(), previews.getHeight(), previews.getChannels());
+        img.setPreviews(previews.getThumbnail(), nullptr);
+        img.setId(cat->add(path, img.getThumbnail(), nullptr));
+        img.setHueDegrees(medianHue);
+        img.estimateFeatures();
+        cat->setHue(img.getId(), img.getHueDegrees(), img.getFeatures());
+
+        std::lock_guard<std::mutex> lock(mut);
+        images->push_back(std::move(img));
+        return true;
+    }
+
+    decodedImage decoded;
+    std::string error;
+    if (!decoders().decode(thumbnailData, thumbnailSize, decoded, &error))
+        return false;
+
+    image img(path, std::move(decoded.pixels), decoded.width, decoded.height, decoded.channels);
+    img.generateThumbnail();
+    img.setId(cat->add(path, img.getThumbnail(), nullptr));
+
+    if (calculateHue) {
+        img.calculateMedianHue();
+        cat->setHue(img.getId(), img.getHueDegrees(), img.getFeatures());
+        img.releasePixels();
+    }
+
+    std::lock_guard<std::mutex> lock(mut);
+    images->push_back(std::move(img));
+    return true;
+}
+
+/* Hands an image's hue to the catalog, first writing its thumbnail and preview to the store so that neither of them has to hold onto the preview
+ * The viewer reads the preview back from the store's spill file, so memory grows by the thumbnail (160x120 RGBA, 75KB) per image rather than by the 800x600 preview as well
+ * If the store couldn't take it, the preview stays in memory for the viewer as before
+ */
+void publishHue(std::shared_ptr<catalog> cat, std::shared_ptr<thumbnailStore> store, image& img) {
+    const bool stored = img.getThumbnail() && img.getPreview() && store->add(makeFileKey(img.getPath()), img.getHueDegrees(), img.getFeatures(), *img.getThumbnail(), *img.getPreview());
+    if (stored)
+        img.setPreviews(img.getThumbnail(), nullptr);
+    cat->setHue(img.getId(), img.getHueDegrees(), img.getFeatures(), stored);
+}
+
+/* What a streamed decode holds at once: the band and libjpeg's few rows of its own state, then the previews being built (as RGBA, plus their running sums)
+ */
+uint64_t streamFootprint(int width, int channels) {
+    return (uint64_t)width * channels * 64 + (uint64_t)(PREVIEW_WIDTH * PREVIEW_HEIGHT + THUMBNAIL_WIDTH * THUMBNAIL_HEIGHT) * 4 + PREVIEW_WIDTH * 4 * sizeof(uint64_t);
+}
+
+/* The "--stream-decode" path: the pixels go into the hue histogram and the previews a band of rows at a time, and are then dropped
+ * Memory per image is then bounded by the width rather than the whole image, so far more images fit in the budget at once
+ * False if no backend can stream this file, in which case it's decoded as normal
+ */
+bool loadStreamedImage(std::shared_ptr<std::vector<image>> images, std::shared_ptr<catalog> cat, std::shared_ptr<thumbnailStore> store, std::shared_ptr<memoryBudget> budget, std::string path, const std::vector<uint8_t>& fileData, int width, int channels) {
+    const uint64_t footprint = streamFootprint(width, channels);
+    budget->acquire(footprint);
+
+    bandAnalyser analysis;
+    std::string error;
+    if (!decoders().decodeBands(fileData.data(), fileData.size(), analysis, &error)) {
+        budget->release(footprint);
+        return false;
+    }
+
+    image img(path, pixelBuffer(), analysis.getWidth(), analysis.getHeight(), analysis.getChannels());
+    img.setPreviews(analysis.getThumbnail(), analysis.getPreview());
+    img.setId(cat->add(path, img.getThumbnail(), img.getPreview()));
+    img.setHueDegrees(analysis.getMedianHue());
+    img.setFeatures(analysis.getFeatures());
+    publishHue(cat, store, img);
+    budget->release(footprint);
+
+    std::lock_guard<std::mutex> lock(mut);
+    images->push_back(std::move(img));
+    return true;
+}
+
+/* The "--chroma-hue" path for a JPEG: one raw pass over its Y, Cb and Cr planes gives both the hue (from the chroma alone) and the previews, so it's never upsampled or converted to RGB at full size
+ * It holds about what a streamed decode does, plus the histogram of chroma pairs; the rest of the features then come from the preview
+ * False if the file isn't a YCbCr or greyscale JPEG, in which case it's decoded as normal
+ */
+bool loadChromaImage(std::shared_ptr<std::vector<image>> images, std::shared_ptr<catalog> cat, std::shared_ptr<thumbnailStore> store, std::shared_ptr<memoryBudget> budget, std::string path, const std::vector<uint8_t>& fileData, int width, int channels) {
+    const uint64_t footprint = streamFootprint(width, channels) + 256 * 256 * sizeof(uint32_t);
+    budget->acquire(footprint);
+
+    double medianHue;
+    ycbcrPreviews previews;
+    if (!decoders().medianHue(fileData.data(), fileData.size(), &medianHue, &previews)) {
+        budget->release(footprint);
+        return false;
+    }
+
+    image img(path, pixelBuffer(), previews.getWidth(), previews.getHeight(), previews.getChannels());
+    img.setPreviews(previews.getThumbnail(), previews.getPreview());
+    img.setId(cat->add(path, img.getThumbnail(), img.getPreview()));
+    img.setHueDegrees(medianHue);
+    img.estimateFeatures();
+    publishHue(cat, store, img);
+    budget->release(footprint);
+
+    std::lock_guard<std::mutex> lock(mut);
+    images->push_back(std::move(img));
+    return true;
+}
+
+// decodes a file that has already been read into memory, so the thread doing this never waits on the disk
+void loadImageData(std::shared_ptr<std::vector<image>> images, std::shared_ptr<catalog> cat, std::shared_ptr<thumbnailStore> store, std::shared_ptr<memoryBudget> budget, [[maybe_unused]] workerPool* pool, std::string path, const std::vector<uint8_t>& fileData, bool calculateHue)
 {
+    if (decoders().getExifThumbnails() && loadExifImage(images, cat, path, fileData, calculateHue))
+        return;
+
     int width, height, n; // n is the number of components that you retrieved from the image. 3 if it's RGB only (all JPG images should be 3) or 4 if it's RGBA (e.g. some PNG images)
-    auto imgdata = (char*)stbi_load(path.c_str(), &width, &height, &n, 0);
+    std::string error;
 
-    std::vector<uint8_t> image_data(imgdata, imgdata + width * height * n);
+    // only the header is read first, so the decode can wait for room in the budget before it allocates anything
+    if (!decoders().info(fileData.data(), fileData.size(), &width, &height, &n, &error)) {
+        std::cout << "(!) failed to load \"" << path << "\": " << error << std::endl;
+        return;
+    }
 
-    /* This is the only place which the Mutex is applied as the "images" vector is modified here by multiple "loadImageData" threads
-     * The thread for calculating the median hues doesn't modify the list, but the objects inside, which all have only one corresponding thread anyway
-     * The thread for sorting the vector of images uses C++'s "std::sort", which is only running in parallel of the UI thread as I can't parallelise "std::sort" any further
+    // both of these only make sense when the hue is worked out here, the sequential version needs the whole image for its separate hue stage
+    if (calculateHue && decoders().getChromaHue() && loadChromaImage(images, cat, store, budget, path, fileData, width, n))
+        return;
+    if (calculateHue && decoders().getStreaming() && loadStreamedImage(images, cat, store, budget, path, fileData, width, n))
+        return;
+
+    const uint64_t footprint = decodeFootprint(width, height, n);
+    budget->acquire(footprint);
+
+    // whichever backend the registry has chosen for this file's format, stb unless a benchmark found something quicker
+    decodedImage decoded;
+    bool decodedFile = false;
+#ifdef HAVE_LIBJPEG
+    /* A very large JPEG with restart markers is split up and decoded by the pool's workers together
+     * Otherwise it would be the one task still running at the end with every other worker idle, however early it was started
+     */
+    if (pool && (uint64_t)width * height >= PARALLEL_DECODE_PIXELS && detectFormat(fileData.data(), fileData.size()) == imageFormat::jpeg)
+        decodedFile = decodeRestartIntervals(fileData.data(), fileData.size(), decoded, *pool, &error);
+#endif
+    if (!decodedFile && !decoders().decode(fileData.data(), fileData.size(), decoded, &error)) {
+        budget->release(footprint);
+        std::cout << "(!) failed to load \"" << path << "\": " << error << std::endl;
+        return;
+    }
+
+    // the thumbnail and preview are made here while the pixels are still hot in the cache, they're written to the store once the hues are known
+    image img(path, std::move(decoded.pixels), decoded.width, decoded.height, decoded.channels);
+    img.generatePreviews();
+
+    // the image goes into the catalog as soon as it can be shown, which for the first one is what the viewer is waiting on
+    img.setId(cat->add(path, img.getThumbnail(), img.getPreview()));
+
+    // the hue is worked out on this thread too, so the image can join the catalog's hue order without waiting for any other image
+    if (calculateHue) {
+        img.calculateMedianHue();
+        publishHue(cat, store, img);
+
+        // all that's kept from here on is the thumbnail and preview, so memory doesn't grow with the full-size pixels of every image loaded
+        img.releasePixels();
+    }
+
+    /* The sequential version keeps its pixels for a separate hue stage; it only ever decodes one image at a time, so there's nothing for the budget to hold back
+     * Otherwise the pixels have just been released
+     */
+    budget->release(footprint);
+
+    /* The mutex only guards "images", which every loading thread appends to; nothing else touches the vector until they've all finished
+     * Only the timings and the sequential version's separate hue and sort stages use it; the viewer's order comes from the catalog, so the UI thread never reads it
      */
     std::lock_guard<std::mutex> lock(mut);
-    images->push_back(image(path, image_data));
+    images->push_back(std::move(img));
+}
+
+// reads and decodes a file on the calling thread, for where there's nothing for a separate read to overlap with
+void readAndLoadImageData(std::shared_ptr<std::vector<image>> images, std::shared_ptr<catalog> cat, std::shared_ptr<thumbnailStore> store, std::shared_ptr<memoryBudget> budget, std::string path, bool calculateHue) {
+    std::vector<uint8_t> fileData;
+    if (!readFile(path, fileData)) {
+        std::cout << "(!) failed to read \"" << path << "\"" << std::endl;
+        return;
+    }
+    loadImageData(images, cat, store, budget, nullptr, path, fileData, calculateHue);
+}
 
-    stbi_image_free(imgdata);
+/* Every decoded image was added to the store as soon as its hue was known (see "publishHue"), so this only writes out the new store
+ * Images only loaded from their EXIF thumbnail have no preview to store, and they're cheap to load again anyway
+ */
+void saveThumbnails(std::shared_ptr<thumbnailStore> store) {
+    if (store->save())
+        std::cout << "Thumbnail store saved (" << store->size() << " images)" << std::endl;
 }
 
-void t_sortImagesByHue(std::shared_ptr<std::vector<std::thread>> threadPool, std::shared_ptr<std::vector<image>> images, std::shared_ptr<std::vector<std::chrono::milliseconds>> times, std::chrono::system_clock::time_point threadingStart) {
+// the catalog has been kept in hue order as each image arrived, so there's nothing left to sort; this stage only tells the viewer nothing more is coming, once the other keys are sorted too
+void t_sortImagesByHue(std::shared_ptr<catalog> cat, std::shared_ptr<thumbnailStore> store, std::shared_ptr<std::vector<std::chrono::milliseconds>> times, std::chrono::system_clock::time_point threadingStart) {
     std::cout << "Image Sorting thread started" << std::endl;
 
-    std::sort(images->begin(), images->end(), [](image a, image b) { return a.getMedianHue() < b.getMedianHue(); });
+    cat->finish();
 
     auto stop = std::chrono::system_clock::now();
     auto totalTimeOfSort = stop - threadingStart;
@@ -71,64 +349,83 @@ void t_sortImagesByHue(std::shared_ptr<std::vector<std::thread>> threadPool, std
     std::cout << "Image Sorting thread elapsed time: " << time.count() / 1000.0 << "s" << std::endl;
 
     times->push_back(time);
-}
 
-void t_calculateMedianHues(std::shared_ptr<std::vector<std::thread>> threadPool, std::shared_ptr<std::vector<image>> images, std::shared_ptr<std::vector<std::chrono::milliseconds>> times, std::chrono::system_clock::time_point threadingStart) {
-    std::cout << "Calculate Median Hues thread started" << std::endl;
+    // done after the timing so the store's disk write isn't counted against the sort
+    saveThumbnails(store);
+}
 
-    for (unsigned int i = 0; i < images->size(); i++) { // minus 1 to leave a thread for the UI
-        threadPool->push_back(std::thread(&image::calculateMedianHue, std::ref(images->at(i))));
+void t_loadImages(std::shared_ptr<std::vector<image>> images, std::shared_ptr<catalog> cat, std::shared_ptr<thumbnailStore> store, std::shared_ptr<memoryBudget> budget, std::shared_ptr<std::vector<std::chrono::milliseconds>> times, std::vector<std::string> roots, loadSettings settings) {
+    std::cout << "Image Loading thread started" << std::endl;
 
-        // prevents thrashing of the CPU; if the amount of threads in the thread pool is reaching the number of threads in the system hardware, then join each thread until the pool is empty
-        if (threadPool->size() >= std::thread::hardware_concurrency() - 2) { // minus 2 instead of 1 to leave one thread for the UI
-            for (std::thread& t : (*threadPool))
-                t.join();
-            threadPool->clear();
-        }
-    }
-    for (std::thread& t : (*threadPool))
-        t.join();
-    threadPool->clear();
+    auto start = std::chrono::system_clock::now();
 
-    auto stop = std::chrono::system_clock::now();
-    auto totalTimeOfThreadPool = stop - threadingStart;
+    // minus 2 to leave one thread for the UI and one for the first image; at least one so a 1 or 2 core machine still has a worker
+    const unsigned int maxThreads = std::max(1u, std::thread::hardware_concurrency() > 2 ? std::thread::hardware_concurrency() - 2 : 1u);
 
-    std::chrono::milliseconds time = std::chrono::duration_cast<std::chrono::milliseconds>(totalTimeOfThreadPool);
-    std::cout << "Calculate Median Hues thread elapsed time: " << time.count() / 1000.0 << "s" << std::endl;
+    /* There used to be a separate "t_calculateMedianHues" stage after this one, as "image::calculateMedianHue" couldn't be invoked here until the image object was constructed
+     * "loadImageData" now calculates the hue itself straight after constructing the object, on the same thread
+     * This means each image joins the catalog's hue order as soon as it's ready, instead of every image waiting for the slowest one to load
+     */
+    std::shared_ptr<workerPool> pool = std::make_shared<workerPool>(maxThreads);
 
-    times->push_back(time);
-    
-    std::thread sortByHuesThread(t_sortImagesByHue, threadPool, images, times, threadingStart);
-    sortByHuesThread.join();
-}
+    /* Every decode, including the first image's, waits for its share of "budget" before allocating, which is what bounds memory however many images there are
+     * It also holds back the reader indirectly: a blocked decode doesn't release its file's bytes, so reading stops once its own budget is full too
+     */
 
-void t_loadImages(std::shared_ptr<std::vector<image>> images, std::shared_ptr<std::vector<std::chrono::milliseconds>> times) {
-    std::cout << "Image Loading thread started" << std::endl;
+    /* The first image is started on its own thread before any of the bulk loading, and isn't queued in the pool
+     * The scanner hands files over as it finds them, so this doesn't wait for the directories to be listed either
+     * This way the time until the viewer can show a real image is one image's decode, however many files there are
+     */
+    std::thread firstImageThread;
+    std::mutex firstImageMutex;
 
-    std::shared_ptr<std::vector<std::thread>> threadPool = std::make_shared<std::vector<std::thread>>();
+    /* Files are read into memory by the reader's own threads, and only then queued in the pool to be decoded
+     * This keeps the disk busy with several reads at once while every worker is decoding, rather than each worker stopping for its own read
+     * The decode task gives the file's bytes back to the reader's budget once it's done with them, which lets the next read start
+     * Whatever order the files are read in, the viewer still sees them in hue order, as that comes from the catalog and not from when an image arrived
+     */
+    /* The physical orders use a single reader, as several would each take the next file of the sweep at once and the disk would see them interleaved
+     * They also don't probe each header on the scanner's threads, which would be a seek per file in directory order before the sweep even starts; a file's cost is worked out from its bytes once they're read instead
+     */
+    const bool physicalOrder = settings.order != readOrder::largestFirst;
+    fileReader reader(physicalOrder ? 1 : IO_THREADS, settings.readAheadBytes, settings.order, [&](const std::string& path, std::shared_ptr<std::vector<uint8_t>> data, double cost) {
+        if (physicalOrder)
+            cost = estimateDecodeCost(*data);
+        // the pool is passed by pointer, a task holding a reference to its own pool could end up being what destroys it
+        workerPool* helpers = pool.get();
+        pool->submit([images, cat, store, budget, helpers, path, data, &reader]() {
+            loadImageData(images, cat, store, budget, helpers, path, *data, true);
+            reader.release(data->size());
+        }, cost);
+    });
+
+    /* Every file found is queued straight away, so reading and decoding overlap the rest of the directory walk
+     * In "largestFirst" order the header is probed on the scanner's thread, and both the reader and the pool always take the largest queued image next
+     * Scanning is much quicker than decoding, so nearly every file is queued before the workers get far, which makes this close to true largest-first scheduling
+     * Images already in the thumbnail store are added on the scanner's thread, as that's only a lookup and they're the quickest way to fill the viewer
+     */
+    directoryScanner scanner([&](const std::string& path, uint64_t inode) {
+        if (loadCachedImage(images, cat, store, path))
+            return;
 
-    auto start = std::chrono::system_clock::now();
-    
-    
-    for (fs::directory_iterator dirItr(IMAGES_DIRECTORY), endItr; dirItr != endItr; dirItr++) { // minus 1 to leave a thread for the UI
-        /* I tried to combine "std::thread(&image::calculateMedianHue, std::ref(images->at(imagesProcessed)" from "t_calculateMedianHues" with this thread
-         * The purpose of this was that an image's median hue could be calculated as soon as the image is loaded
-         * But, the class method "image::calculateMedianHue" cannot be invoked until the image is loaded and an object is constructed
-         * Because of this, if "image::calculateMedianHue" is invoked here, there is no way to specify which object to invoke it on without waiting until it's loaded (by joining the thread)
-         * Therefore, combining "t_calculateMedianHues" with this function wouldn't make a difference as we'd still need to wait
-         */
-        threadPool->push_back(std::thread(loadImageData, images, dirItr->path().u8string()));
-
-        // prevents thrashing of the CPU; if the amount of threads in the thread pool is reaching the number of threads in the system hardware, then join each thread until the pool is empty
-        if (threadPool->size() >= std::thread::hardware_concurrency() - 2) { // minus 2 instead of 1 to leave one thread for the UI
-            for (std::thread& t : (*threadPool))
-                t.join();
-            threadPool->clear();
+        {
+            std::lock_guard<std::mutex> lock(firstImageMutex);
+            if (!firstImageThread.joinable()) {
+                firstImageThread = std::thread(readAndLoadImageData, images, cat, store, budget, path, true);
+                return;
+            }
         }
-    }
-    for (std::thread& t : (*threadPool))
-        t.join();
-    threadPool->clear();
+        reader.submit(path, physicalOrder ? 0 : estimateDecodeCost(path), inode);
+    });
+
+    // reading directories is mostly waiting on the disk, so the scanner gets a thread per core (up to 16) on top of the workers
+    scanner.scan(roots, std::max(2u, std::min(16u, std::thread::hardware_concurrency())));
+
+    reader.wait();
+    pool->wait();
+    if (firstImageThread.joinable())
+        firstImageThread.join();
+    cat->publish();
 
     auto stop = std::chrono::system_clock::now();
     auto totalTimeOfThreadPool = stop - start;
@@ -136,52 +433,50 @@ void t_loadImages(std::shared_ptr<std::vector<image>> images, std::shared_ptr<st
     std::chrono::milliseconds time = std::chrono::duration_cast<std::chrono::milliseconds>(totalTimeOfThreadPool);
     std::cout << "Image Loading thread elapsed time: " << time.count() / 1000.0 << "s" << std::endl;
 
+    // the best the pool could have done is all of the work spread perfectly over its workers, so this shows how much the scheduling leaves on the table
+    double idealMakespan = std::chrono::duration<double>(pool->getBusyTime()).count() / pool->size();
+    std::cout << "Image Loading ideal makespan (total work / " << pool->size() << " workers): " << idealMakespan << "s" << std::endl;
+    std::cout << "Image Loading decoded memory peak: " << budget->getPeak() / (1024 * 1024) << "MB (budget " << budget->getLimit() / (1024 * 1024) << "MB)" << std::endl;
+    std::cout << "Image Loading pixel buffers: " << pixelBuffers().getAllocations() << " allocated, " << pixelBuffers().getSystemAllocations() << " from the OS" << std::endl;
+
     times->push_back(time);
     
-    std::thread getHuesThread(t_calculateMedianHues, threadPool, images, times, start);
-    getHuesThread.join();
+    std::thread sortByHuesThread(t_sortImagesByHue, cat, store, times, start);
+    sortByHuesThread.join();
 
     outputTimes(times);
 }
 
-sf::Vector2f ScaleFromDimensions(const sf::Vector2u& textureSize, int screenWidth, int screenHeight)
-{
-    float scaleX = screenWidth / float(textureSize.x);
-    float scaleY = screenHeight / float(textureSize.y);
-    float scale = std::min(scaleX, scaleY);
-    return { scale, scale };
-}
-
-int UIThread(std::shared_ptr<std::vector<image>> images) {
+int UIThread(std::shared_ptr<catalog> cat, std::shared_ptr<thumbnailStore> store, std::shared_ptr<memoryBudget> budget, std::chrono::system_clock::time_point programStart) {
     std::cout << "UI thread started" << std::endl;
 
     // Define some constants
-    const float pi = 3.14159f;
-    const int gameWidth = 800;
-    const int gameHeight = 600;
-
-    int imageIndex = 0;
+    const int gameWidth = viewer::WIDTH;
+    const int gameHeight = viewer::HEIGHT;
 
     // Create the window of the application
     sf::RenderWindow window(sf::VideoMode(gameWidth, gameHeight, 32), "Image Fever",
         sf::Style::Titlebar | sf::Style::Close);
     window.setVerticalSyncEnabled(true);
-    
-    // Load an image to begin with
-    sf::Texture texture;
-    if (!texture.loadFromFile((*images)[imageIndex].getPath()))
-        return EXIT_FAILURE;
-    sf::Sprite sprite(texture);
-    // Make sure the texture fits the screen
-    sprite.setScale(ScaleFromDimensions(texture.getSize(), gameWidth, gameHeight));
-
-    sf::Clock clock;
+
+    viewer view(cat, store, budget, (std::string)PLACEHOLDER_IMAGE);
+    std::string title;
+
+    // time-to-first-frame, for the placeholder and then for the first real image
+    std::chrono::milliseconds timeToPlaceholder(-1), timeToFirstImage(-1);
+
     while (window.isOpen())
     {
+        view.refresh();
+
         // Handle events
         sf::Event event;
         while (window.pollEvent(event))
         {
+            // anything other than the mouse moving over the window could change what's shown, or mean the window needs repainting
+            if (event.type != sf::Event::MouseMoved)
+                view.invalidate();
+
             // Window closed or escape key pressed: exit
             if ((event.type == sf::Event::Closed) ||
                 ((event.type == sf::Event::KeyPressed) && (event.key.code == sf::Keyboard::Escape)))
@@ -193,57 +488,71 @@ int UIThread(std::shared_ptr<std::vector<image>> images) {
             // Window size changed, adjust view appropriately
             if (event.type == sf::Event::Resized)
             {
-                sf::View view;
-                view.setSize(gameWidth, gameHeight);
-                view.setCenter(gameWidth / 2.f, gameHeight / 2.f);
-                window.setView(view);
+                sf::View windowView;
+                windowView.setSize(gameWidth, gameHeight);
+                windowView.setCenter(gameWidth / 2.f, gameHeight / 2.f);
+                window.setView(windowView);
             }
 
             // Arrow key handling!
             if (event.type == sf::Event::KeyPressed)
-            {
-                // adjust the image index
-                if (event.key.code == sf::Keyboard::Key::Left)
-                    imageIndex = (imageIndex + images->size() - 1) % images->size();
-                else if (event.key.code == sf::Keyboard::Key::Right)
-                    imageIndex = (imageIndex + 1) % images->size();
-
-                if (imageIndex < images->size()) {
-                    // get image filename
-                    const auto& imageFilename = (*images)[imageIndex].getPath();
-                    // set it as the window title 
-                    window.setTitle(imageFilename);
-                    // ... and load the appropriate texture, and put it in the sprite
-                    if (!texture.loadFromFile(imageFilename))
-                        texture.loadFromFile((std::string)PLACEHOLDER_IMAGE);
-                }
-                else
-                    texture.loadFromFile((std::string)PLACEHOLDER_IMAGE);
-
-                sprite = sf::Sprite(texture);
-                sprite.setScale(ScaleFromDimensions(texture.getSize(), gameWidth, gameHeight));
+                view.handleKey(event.key.code);
+
+            // the mouse wheel zooms in and out, like the +/- keys
+            if (event.type == sf::Event::MouseWheelScrolled)
+                view.handleScroll(event.mouseWheelScroll.delta);
+
+            // clicks are mapped through the window's view, so the colour wheel is hit in the same place after a resize
+            if (event.type == sf::Event::MouseButtonPressed && event.mouseButton.button == sf::Mouse::Left) {
+                sf::Vector2f at = window.mapPixelToCoords(sf::Vector2i(event.mouseButton.x, event.mouseButton.y));
+                view.handleClick(at.x, at.y);
             }
         }
 
-        // Clear the window
-        window.clear(sf::Color(0, 0, 0));
-        // draw the sprite
-        window.draw(sprite);
+        if (view.getTitle() != title) {
+            title = view.getTitle();
+            window.setTitle(title);
+        }
+
+        if (!view.needsRedraw()) {
+            /* Nothing to draw, so sleep until a worker publishes a new snapshot
+             * SFML 2.5's "waitEvent" can't be woken from another thread (and itself polls in 10ms sleeps), so instead this waits on the catalog with the same 10ms slice
+             * A publish wakes it straight away, and input is picked up by "pollEvent" within 10ms, which keeps an idle viewer's CPU use near zero
+             */
+            if (window.isOpen())
+                cat->waitForChange(view.getSnapshotVersion(), std::chrono::milliseconds(10));
+            continue;
+        }
+
+        view.draw(window);
         // Display things on screen
         window.display();
+
+        if (timeToPlaceholder.count() < 0)
+            timeToPlaceholder = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now() - programStart);
+        if (timeToFirstImage.count() < 0 && view.isShowingImage()) {
+            timeToFirstImage = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now() - programStart);
+            std::cout << "Time to first frame: " << timeToPlaceholder.count() / 1000.0 << "s (placeholder), " << timeToFirstImage.count() / 1000.0 << "s (first image)" << std::endl;
+            outputStartupTimes(timeToPlaceholder, timeToFirstImage);
+        }
     }
 
     return EXIT_SUCCESS;
 }
 
-void sequentialOperations(std::shared_ptr<std::vector<image>> images, std::shared_ptr<std::vector<std::chrono::milliseconds>> times) { // the non-parallelised image loading, convertion, and sorting function
+void sequentialOperations(std::shared_ptr<std::vector<image>> images, std::shared_ptr<catalog> cat, std::shared_ptr<thumbnailStore> store, std::shared_ptr<std::vector<std::chrono::milliseconds>> times, std::vector<std::string> roots) { // the non-parallelised image loading, convertion, and sorting function
     std::cout << "Sequential Operations function started" << std::endl;
     
     auto start = std::chrono::system_clock::now();
+
+    std::shared_ptr<memoryBudget> budget = std::make_shared<memoryBudget>(DECODE_MEMORY_BUDGET);
     
-    int i = 0;
-    for (auto& p : fs::directory_iterator(IMAGES_DIRECTORY))
-        loadImageData(images, p.path().u8string());
+    directoryScanner scanner([&](const std::string& path, uint64_t) {
+        if (!loadCachedImage(images, cat, store, path))
+            readAndLoadImageData(images, cat, store, budget, path, false);
+    });
+    scanner.scan(roots, 1);
+    cat->publish();
 
     auto stop = std::chrono::system_clock::now();
     auto timeElapsed = stop - start;
@@ -254,8 +563,12 @@ void sequentialOperations(std::shared_ptr<std::vector<image>> images, std::share
     times->push_back(time);
 
 
-    for (auto& img : (*images))
+    for (auto& img : (*images)) {
         img.calculateMedianHue();
+        publishHue(cat, store, img);
+        img.releasePixels();
+    }
+    cat->publish();
 
     stop = std::chrono::system_clock::now();
     timeElapsed = stop - start;
@@ -265,7 +578,8 @@ void sequentialOperations(std::shared_ptr<std::vector<image>> images, std::share
 
     times->push_back(time);
     
-    std::sort(images->begin(), images->end(), [](image a, image b) { return a.getMedianHue() < b.getMedianHue(); });
+    std::sort(images->begin(), images->end(), [](const image& a, const image& b) { return a.getMedianHue() < b.getMedianHue(); });
+    cat->finish();
 
     stop = std::chrono::system_clock::now();
     timeElapsed = stop - start;
@@ -275,19 +589,83 @@ void sequentialOperations(std::shared_ptr<std::vector<image>> images, std::share
 
     times->push_back(time);
 
+    saveThumbnails(store);
+
     outputTimes(times);
 }
 
-int main()
+int main(int argc, char* argv[])
 {
+    auto programStart = std::chrono::system_clock::now();
+
     std::shared_ptr<std::vector<std::chrono::milliseconds>> times = std::make_shared<std::vector<std::chrono::milliseconds>>(); // a vector to store the list of times that will be outputted to a CSV
 
     std::shared_ptr<std::vector<image>> images = std::make_shared<std::vector<image>>();
+    std::shared_ptr<catalog> cat = std::make_shared<catalog>(); // what the UI browses, published by the worker threads as they go
+
+    std::shared_ptr<thumbnailStore> store = std::make_shared<thumbnailStore>(THUMBNAIL_STORE);
+    if (store->open())
+        std::cout << "Thumbnail store opened (" << store->size() << " images)" << std::endl;
+
+    // a previous "--benchmark-decoders" run says which backend is quickest for each format on this machine, otherwise everything is left to stb
+    if (decoders().loadThroughput(DECODER_BENCHMARK))
+        std::cout << "Decoders chosen from \"" << DECODER_BENCHMARK << "\" (JPEG: " << decoders().decoderFor(imageFormat::jpeg).getName() << ")" << std::endl;
+
+    // any arguments that aren't options are folders to load, each searched recursively
+    bool benchmark = false;
+    bool benchmarkDecoding = false;
+    loadSettings settings = { IO_BYTES_IN_FLIGHT, readOrder::largestFirst, DECODE_MEMORY_BUDGET };
+    std::vector<std::string> roots;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--benchmark-ui")
+            benchmark = true;
+        else if (arg == "--benchmark-decoders")
+            benchmarkDecoding = true;
+        else if (arg == "--read-ahead-mb" && i + 1 < argc)
+            settings.readAheadBytes = std::max(1ull, std::strtoull(argv[++i], nullptr, 10)) * 1024 * 1024; // how much read but not yet decoded file data is allowed
+        else if (arg == "--chroma-hue")
+            decoders().setChromaHue(true); // take JPEGs' hues from their Cb/Cr planes rather than from RGB
+        else if (arg == "--exif-thumbnails")
+            decoders().setExifThumbnails(true); // sort JPEGs by the hue of their embedded thumbnail, without decoding the photo
+        else if (arg == "--stream-decode")
+            decoders().setStreaming(true); // decode JPEGs a band at a time, never holding the whole image
+        else if (arg == "--perceptual-hue")
+            setPerceptualFeatures(true); // work out the OKLab hue and lightness for the perceptual sort key as well
+        else if (arg == "--huge-pages")
+            pixelBuffers().setHugePages(true); // back pixel buffers with transparent huge pages, where the kernel allows it
+        else if (arg == "--memory-budget-mb" && i + 1 < argc)
+            settings.decodeBytes = std::max(1ull, std::strtoull(argv[++i], nullptr, 10)) * 1024 * 1024; // how much decoded pixel data is allowed at once
+        else if (arg == "--read-order" && i + 1 < argc) {
+            // "inode" or "extent" sweep across a spinning disk rather than seeking back and forth, anything else keeps largest-first
+            std::string value = argv[++i];
+            settings.order = value == "inode" ? readOrder::inode : value == "extent" ? readOrder::extent : readOrder::largestFirst;
+        }
+        else
+            roots.push_back(arg);
+    }
+    if (roots.empty())
+        roots.push_back(IMAGES_DIRECTORY);
+
+    // "--benchmark-decoders" times each decoder backend on a sample of the files and saves which is quickest, without loading anything
+    if (benchmarkDecoding)
+        return benchmarkDecoders(roots);
+
+    // decoded pixels alive at once, shared by the loading threads and the viewer's zoom pyramids
+    std::shared_ptr<memoryBudget> budget = std::make_shared<memoryBudget>(settings.decodeBytes);
+    // freed pixel buffers the pool keeps for reuse only take up what the reservations leave, so the budget bounds those too
+    budget->setHeadroomCallback([](uint64_t headroom) { pixelBuffers().setCacheLimit(headroom); });
+
+    // "--benchmark-ui" loads everything first and then measures the viewer offscreen, rather than opening a window
+    if (benchmark) {
+        t_loadImages(images, cat, store, budget, times, roots, settings);
+        return benchmarkUI(cat, store, budget, (std::string)PLACEHOLDER_IMAGE);
+    }
 
-    std::future<int> UIFuture = std::async(UIThread, images);
+    std::future<int> UIFuture = std::async(UIThread, cat, store, budget, programStart);
 
-    std::thread loadImagesThread(t_loadImages, images, times);
-    //std::thread sequentialOperationsThread(sequentialOperations, images, times);
+    std::thread loadImagesThread(t_loadImages, images, cat, store, budget, times, roots, settings);
+    //std::thread sequentialOperationsThread(sequentialOperations, images, cat, store, times, roots);
 
     return UIFuture.get();
 }
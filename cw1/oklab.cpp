@@ -0,0 +1,336 @@
+#include "oklab.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define OKLAB_SSE2
+#include <emmintrin.h>
+#endif
+
+/* AVX2 and FMA, like SSSE3 in "planes.cpp", are compiled separately on GCC and Clang and only used if the CPU has them
+ * They're worth it here rather than for the hue: 8 lanes, the table lookups become one gather per channel, and the matrices fused multiply-adds
+ */
+#if defined(__AVX2__) && defined(__FMA__)
+#define OKLAB_AVX2
+#define OKLAB_AVX2_TARGET
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define OKLAB_AVX2
+#define OKLAB_AVX2_TARGET __attribute__((target("avx2,fma")))
+#endif
+
+#ifdef OKLAB_AVX2
+#include <immintrin.h>
+#endif
+
+#define DEGREES_PER_RADIAN 57.29577951308232f
+#define HALF_PI 1.5707963267948966f
+#define PI 3.141592653589793f
+// added to a float's bits read as an integer after dividing them by 3, which gives the cube root to within a few percent
+#define CBRT_MAGIC 0x2a514067
+
+// linear sRGB to OKLab's cone responses, and from their cube roots to L, a and b (Ottosson's matrices)
+static const float toCones[3][3] = {
+    { 0.4122214708f, 0.5363325363f, 0.0514459929f },
+    { 0.2119034982f, 0.6806995451f, 0.1073969566f },
+    { 0.0883024619f, 0.2817188376f, 0.6299787005f },
+};
+static const float toLab[3][3] = {
+    { 0.2104542553f, 0.7936177850f, -0.0040720468f },
+    { 1.9779984951f, -2.4285922050f, 0.4505937099f },
+    { 0.0259040371f, 0.7827717662f, -0.8086757660f },
+};
+
+double srgbToLinear(const double channel) {
+    double c = channel / 255.0;
+    return c <= 0.04045 ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4);
+}
+
+// sRGB's curve undone for each of the 256 levels, so it's a load per channel rather than a "pow"
+static const float* linearTable() {
+    static const std::vector<float> table = []() {
+        std::vector<float> built(256);
+        for (int i = 0; i < 256; i++)
+            built[i] = (float)srgbToLinear(i);
+        return built;
+    }();
+    return table.data();
+}
+
+/* The cube root of a cone response (0 to 1) without "cbrtf": a guess from the exponent bits, then two Newton steps, which gets to about float precision
+ * The division by 3 is done in float rather than integer, as SSE2 has no integer divide; both versions do exactly the same operations so they agree to the bit
+ */
+static float fastCbrt(const float x) {
+    if (!(x > 0.0f))
+        return 0.0f;
+
+    int32_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    bits = (int32_t)((float)bits * (1.0f / 3.0f)) + CBRT_MAGIC;
+    float y;
+    memcpy(&y, &bits, sizeof(y));
+
+    y = (y + y + x / (y * y)) * (1.0f / 3.0f);
+    y = (y + y + x / (y * y)) * (1.0f / 3.0f);
+    return y;
+}
+
+/* atan2 in degrees (0-360) from a polynomial on the first octant, then reflected into the right one; off by at most about 0.015 degrees
+ * a = b = 0 gives 0, the same as atan2
+ */
+static float fastHueAngle(const float a, const float b) {
+    float absA = fabsf(a), absB = fabsf(b);
+    float larger = absA > absB ? absA : absB;
+    float smaller = absA < absB ? absA : absB;
+    float t = smaller / (larger > 1e-30f ? larger : 1e-30f);
+    float s = t * t;
+    float angle = ((-0.0464964749f * s + 0.15931422f) * s - 0.327622764f) * s * t + t;
+
+    angle = absB > absA ? HALF_PI - angle : angle;
+    angle = a < 0.0f ? PI - angle : angle;
+    angle = b < 0.0f ? -angle : angle;
+    angle *= DEGREES_PER_RADIAN;
+    return angle < 0.0f ? angle + 360.0f : angle;
+}
+
+static void oklabPixel(const float r, const float g, const float b, float* lightness, float* chroma, float* hue) {
+    float cones[3];
+    for (int i = 0; i < 3; i++)
+        cones[i] = fastCbrt(toCones[i][0] * r + toCones[i][1] * g + toCones[i][2] * b);
+
+    float lab[3];
+    for (int i = 0; i < 3; i++)
+        lab[i] = toLab[i][0] * cones[0] + toLab[i][1] * cones[1] + toLab[i][2] * cones[2];
+
+    *lightness = lab[0];
+    *chroma = sqrtf(lab[1] * lab[1] + lab[2] * lab[2]);
+    *hue = fastHueAngle(lab[1], lab[2]);
+}
+
+#ifdef OKLAB_SSE2
+static inline __m128 select(const __m128 mask, const __m128 a, const __m128 b) {
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+static inline __m128 cbrt4(const __m128 x) {
+    const __m128 third = _mm_set1_ps(1.0f / 3.0f);
+    __m128i bits = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_castps_si128(x)), third));
+    __m128 y = _mm_castsi128_ps(_mm_add_epi32(bits, _mm_set1_epi32(CBRT_MAGIC)));
+
+    y = _mm_mul_ps(_mm_add_ps(_mm_add_ps(y, y), _mm_div_ps(x, _mm_mul_ps(y, y))), third);
+    y = _mm_mul_ps(_mm_add_ps(_mm_add_ps(y, y), _mm_div_ps(x, _mm_mul_ps(y, y))), third);
+    return _mm_and_ps(_mm_cmpgt_ps(x, _mm_setzero_ps()), y);
+}
+
+static inline __m128 hueAngle4(const __m128 a, const __m128 b) {
+    const __m128 signMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    const __m128 zero = _mm_setzero_ps();
+    __m128 absA = _mm_and_ps(a, signMask), absB = _mm_and_ps(b, signMask);
+    __m128 larger = _mm_max_ps(absA, absB);
+    __m128 t = _mm_div_ps(_mm_min_ps(absA, absB), _mm_max_ps(larger, _mm_set1_ps(1e-30f)));
+    __m128 s = _mm_mul_ps(t, t);
+    __m128 angle = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(-0.0464964749f), s), _mm_set1_ps(0.15931422f));
+    angle = _mm_sub_ps(_mm_mul_ps(angle, s), _mm_set1_ps(0.327622764f));
+    angle = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(angle, s), t), t);
+
+    angle = select(_mm_cmpgt_ps(absB, absA), _mm_sub_ps(_mm_set1_ps(HALF_PI), angle), angle);
+    angle = select(_mm_cmplt_ps(a, zero), _mm_sub_ps(_mm_set1_ps(PI), angle), angle);
+    angle = select(_mm_cmplt_ps(b, zero), _mm_sub_ps(zero, angle), angle);
+    angle = _mm_mul_ps(angle, _mm_set1_ps(DEGREES_PER_RADIAN));
+    return _mm_add_ps(angle, _mm_and_ps(_mm_cmplt_ps(angle, zero), _mm_set1_ps(360.0f)));
+}
+
+// the sum of row "row" of "matrix" times x, y and z
+static inline __m128 multiplyRow(const float matrix[3][3], const int row, const __m128 x, const __m128 y, const __m128 z) {
+    __m128 sum = _mm_mul_ps(_mm_set1_ps(matrix[row][0]), x);
+    sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(matrix[row][1]), y));
+    return _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(matrix[row][2]), z));
+}
+
+// SSE2 has no gather, so the table lookups are 4 scalar loads; everything after them is 4 pixels at a time
+static inline __m128 lookup4(const float* table, const uint8_t* plane) {
+    return _mm_setr_ps(table[plane[0]], table[plane[1]], table[plane[2]], table[plane[3]]);
+}
+#endif
+
+#ifdef OKLAB_AVX2
+static bool hasAvx2() {
+#if defined(__AVX2__) && defined(__FMA__)
+    return true;
+#else
+    static const bool supported = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    return supported;
+#endif
+}
+
+OKLAB_AVX2_TARGET static inline __m256 select8(const __m256 mask, const __m256 a, const __m256 b) {
+    return _mm256_blendv_ps(b, a, mask);
+}
+
+OKLAB_AVX2_TARGET static inline __m256 cbrt8(const __m256 x) {
+    const __m256 third = _mm256_set1_ps(1.0f / 3.0f);
+    __m256i bits = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_castps_si256(x)), third));
+    __m256 y = _mm256_castsi256_ps(_mm256_add_epi32(bits, _mm256_set1_epi32(CBRT_MAGIC)));
+
+    y = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(y, y), _mm256_div_ps(x, _mm256_mul_ps(y, y))), third);
+    y = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(y, y), _mm256_div_ps(x, _mm256_mul_ps(y, y))), third);
+    return _mm256_and_ps(_mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_GT_OQ), y);
+}
+
+OKLAB_AVX2_TARGET static inline __m256 hueAngle8(const __m256 a, const __m256 b) {
+    const __m256 signMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    const __m256 zero = _mm256_setzero_ps();
+    __m256 absA = _mm256_and_ps(a, signMask), absB = _mm256_and_ps(b, signMask);
+    __m256 larger = _mm256_max_ps(absA, absB);
+    __m256 t = _mm256_div_ps(_mm256_min_ps(absA, absB), _mm256_max_ps(larger, _mm256_set1_ps(1e-30f)));
+    __m256 s = _mm256_mul_ps(t, t);
+    __m256 angle = _mm256_fmadd_ps(_mm256_set1_ps(-0.0464964749f), s, _mm256_set1_ps(0.15931422f));
+    angle = _mm256_fmsub_ps(angle, s, _mm256_set1_ps(0.327622764f));
+    angle = _mm256_fmadd_ps(_mm256_mul_ps(angle, s), t, t);
+
+    angle = select8(_mm256_cmp_ps(absB, absA, _CMP_GT_OQ), _mm256_sub_ps(_mm256_set1_ps(HALF_PI), angle), angle);
+    angle = select8(_mm256_cmp_ps(a, zero, _CMP_LT_OQ), _mm256_sub_ps(_mm256_set1_ps(PI), angle), angle);
+    angle = select8(_mm256_cmp_ps(b, zero, _CMP_LT_OQ), _mm256_sub_ps(zero, angle), angle);
+    angle = _mm256_mul_ps(angle, _mm256_set1_ps(DEGREES_PER_RADIAN));
+    return _mm256_add_ps(angle, _mm256_and_ps(_mm256_cmp_ps(angle, zero, _CMP_LT_OQ), _mm256_set1_ps(360.0f)));
+}
+
+OKLAB_AVX2_TARGET static inline __m256 multiplyRow8(const float matrix[3][3], const int row, const __m256 x, const __m256 y, const __m256 z) {
+    __m256 sum = _mm256_mul_ps(_mm256_set1_ps(matrix[row][0]), x);
+    sum = _mm256_fmadd_ps(_mm256_set1_ps(matrix[row][1]), y, sum);
+    return _mm256_fmadd_ps(_mm256_set1_ps(matrix[row][2]), z, sum);
+}
+
+OKLAB_AVX2_TARGET static inline __m256 lookup8(const float* table, const uint8_t* plane) {
+    return _mm256_i32gather_ps(table, _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)plane)), 4);
+}
+
+// 8 pixels at a time; returns how many were done. The fused multiply-adds round once rather than twice, so this can differ from the others by about a float's last bit
+OKLAB_AVX2_TARGET static size_t oklabWide(const float* table, const pixelTile& tile, const size_t count, oklabTile& out) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 r = lookup8(table, tile.planes[0] + i);
+        __m256 g = lookup8(table, tile.planes[1] + i);
+        __m256 b = lookup8(table, tile.planes[2] + i);
+
+        __m256 l = cbrt8(multiplyRow8(toCones, 0, r, g, b));
+        __m256 m = cbrt8(multiplyRow8(toCones, 1, r, g, b));
+        __m256 s = cbrt8(multiplyRow8(toCones, 2, r, g, b));
+
+        __m256 labA = multiplyRow8(toLab, 1, l, m, s);
+        __m256 labB = multiplyRow8(toLab, 2, l, m, s);
+        _mm256_store_ps(out.lightness + i, multiplyRow8(toLab, 0, l, m, s));
+        _mm256_store_ps(out.chroma + i, _mm256_sqrt_ps(_mm256_fmadd_ps(labA, labA, _mm256_mul_ps(labB, labB))));
+        _mm256_store_ps(out.hues + i, hueAngle8(labA, labB));
+    }
+    return i;
+}
+#endif
+
+void planarOklab(const pixelTile& tile, const size_t count, oklabTile& out) {
+    const float* table = linearTable();
+    size_t i = 0;
+#ifdef OKLAB_AVX2
+    if (hasAvx2())
+        i = oklabWide(table, tile, count, out);
+#endif
+#ifdef OKLAB_SSE2
+    for (; i + 4 <= count; i += 4) {
+        __m128 r = lookup4(table, tile.planes[0] + i);
+        __m128 g = lookup4(table, tile.planes[1] + i);
+        __m128 b = lookup4(table, tile.planes[2] + i);
+
+        __m128 l = cbrt4(multiplyRow(toCones, 0, r, g, b));
+        __m128 m = cbrt4(multiplyRow(toCones, 1, r, g, b));
+        __m128 s = cbrt4(multiplyRow(toCones, 2, r, g, b));
+
+        __m128 labA = multiplyRow(toLab, 1, l, m, s);
+        __m128 labB = multiplyRow(toLab, 2, l, m, s);
+        _mm_store_ps(out.lightness + i, multiplyRow(toLab, 0, l, m, s));
+        _mm_store_ps(out.chroma + i, _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(labA, labA), _mm_mul_ps(labB, labB))));
+        _mm_store_ps(out.hues + i, hueAngle4(labA, labB));
+    }
+#endif
+    for (; i < count; i++)
+        oklabPixel(table[tile.planes[0][i]], table[tile.planes[1][i]], table[tile.planes[2][i]], out.lightness + i, out.chroma + i, out.hues + i);
+}
+
+void oklabReference(const double r, const double g, const double b, double lch[3]) {
+    double lr = srgbToLinear(r), lg = srgbToLinear(g), lb = srgbToLinear(b);
+    double cones[3];
+    for (int i = 0; i < 3; i++)
+        cones[i] = cbrt(toCones[i][0] * lr + toCones[i][1] * lg + toCones[i][2] * lb);
+
+    double lab[3];
+    for (int i = 0; i < 3; i++)
+        lab[i] = toLab[i][0] * cones[0] + toLab[i][1] * cones[1] + toLab[i][2] * cones[2];
+
+    double hue = atan2(lab[2], lab[1]) * 180.0 / 3.141592653589793;
+    lch[0] = lab[0];
+    lch[1] = sqrt(lab[1] * lab[1] + lab[2] * lab[2]);
+    lch[2] = hue < 0 ? hue + 360.0 : hue;
+}
+
+// the value "total / 2" of the way into a histogram, interpolated within its bin, in bins from "first" going round
+static double histogramMiddle(const uint64_t* counts, const int bins, const int first, const uint64_t total) {
+    const double middle = total / 2.0;
+    uint64_t seen = 0;
+    for (int k = 0; k < bins; k++) {
+        const uint64_t n = counts[(first + k) % bins];
+        if (seen + n > middle)
+            return k + (middle - seen) / n;
+        seen += n;
+    }
+    return bins;
+}
+
+void perceptualAccumulator::add(const pixelTile& tile, const size_t count, const bool alpha) {
+    static thread_local oklabTile converted; // 24KB, a bit much for every thread's stack each time
+    planarOklab(tile, count, converted);
+
+    for (size_t i = 0; i < count; i++) {
+        if (alpha && tile.planes[3][i] == 0)
+            continue;
+
+        const float lightness = converted.lightness[i] * OKLAB_LIGHTNESS_BINS;
+        this->lightnessCounts[lightness <= 0.0f ? 0 : lightness >= OKLAB_LIGHTNESS_BINS - 1 ? OKLAB_LIGHTNESS_BINS - 1 : (int)lightness]++;
+        this->pixels++;
+        if (converted.chroma[i] < OKLAB_NEUTRAL_CHROMA)
+            continue;
+
+        this->hueCounts[std::min(OKLAB_HUE_BINS - 1, (int)(converted.hues[i] * (OKLAB_HUE_BINS / 360.0f)))]++;
+        this->chromatic++;
+    }
+}
+
+void perceptualAccumulator::finish(float* hue, float* lightness) const {
+    *hue = -1.0f;
+    *lightness = 0.0f;
+    if (this->pixels == 0)
+        return;
+
+    *lightness = (float)(histogramMiddle(this->lightnessCounts, OKLAB_LIGHTNESS_BINS, 0, this->pixels) / OKLAB_LIGHTNESS_BINS);
+    if (this->chromatic == 0 || this->chromatic < this->pixels * OKLAB_NEUTRAL_SHARE)
+        return;
+
+    // the emptiest window, found by sliding it round the circle a bin at a time
+    uint64_t window = 0;
+    for (int k = 0; k < OKLAB_CUT_BINS; k++)
+        window += this->hueCounts[k];
+    uint64_t emptiest = window;
+    int emptiestStart = 0;
+    for (int start = 1; start < OKLAB_HUE_BINS; start++) {
+        window += this->hueCounts[(start + OKLAB_CUT_BINS - 1) % OKLAB_HUE_BINS];
+        window -= this->hueCounts[start - 1];
+        if (window < emptiest) {
+            emptiest = window;
+            emptiestStart = start;
+        }
+    }
+
+    const int cut = (emptiestStart + OKLAB_CUT_BINS / 2) % OKLAB_HUE_BINS;
+    double angle = (cut + histogramMiddle(this->hueCounts, OKLAB_HUE_BINS, cut, this->chromatic)) * (360.0 / OKLAB_HUE_BINS);
+    *hue = (float)fmod(angle, 360.0);
+}
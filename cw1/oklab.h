@@ -0,0 +1,49 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "planes.h"
+
+// OKLab chroma below which a pixel counts as neutral: its a and b are mostly noise and JPEG rounding by then, so its hue angle means nothing
+#define OKLAB_NEUTRAL_CHROMA 0.02f
+// an image with fewer chromatic pixels than this share of it has no perceptual hue, and is sorted by lightness alone
+#define OKLAB_NEUTRAL_SHARE 0.02
+// half a degree per hue angle bin, and 1024 levels of lightness; the medians are interpolated within a bin
+#define OKLAB_HUE_BINS 720
+#define OKLAB_LIGHTNESS_BINS 1024
+// the circle of hue angles is cut for the median in the middle of its emptiest 30 degrees
+#define OKLAB_CUT_BINS 60
+
+/* A tile's pixels in OKLab, in polar form (lightness, chroma and hue angle), which is what sorting wants
+ * OKLab rather than HSV because equal steps of its hue angle look like equal changes of colour; HSV's crowd greens together and spread out the blues
+ * Filled from a "pixelTile" while that's still in the cache, see "planarOklab"
+ */
+typedef struct {
+	alignas(64) float lightness[PLANE_TILE_PIXELS]; // 0 (black) to 1 (white)
+	alignas(64) float chroma[PLANE_TILE_PIXELS]; // 0 for grey, up to about 0.32 for sRGB's most vivid colours
+	alignas(64) float hues[PLANE_TILE_PIXELS]; // atan2(b, a) in degrees, 0-360
+} oklabTile;
+
+// an sRGB channel (0-255) with its gamma curve undone, 0-1; the CIELAB means in "featureAccumulator" start from the same one as OKLab
+double srgbToLinear(double channel);
+
+// converts the first "count" pixels of the tile's planes, 4 at a time with SSE2 where the CPU has it
+void planarOklab(const pixelTile& tile, size_t count, oklabTile& out);
+// the same conversion for a single pixel in double precision, for checking the fast one against
+void oklabReference(double r, double g, double b, double lch[3]);
+
+/* The perceptual ordering of an image: the median OKLab hue angle of its chromatic pixels and the median lightness of all of them
+ * Hue angles go round in a circle, so there's no first or last to take the middle of; the circle is cut where there are fewest hues, which keeps e.g. reds either side of 0 together
+ * Medians rather than means, so a small patch of something vivid doesn't drag the image's place in the order
+ */
+class perceptualAccumulator
+{
+private:
+	uint64_t hueCounts[OKLAB_HUE_BINS] = {};
+	uint64_t lightnessCounts[OKLAB_LIGHTNESS_BINS] = {};
+	uint64_t chromatic = 0;
+	uint64_t pixels = 0;
+public:
+	void add(const pixelTile& tile, size_t count, bool alpha);
+	// "hue" is in degrees, or negative for an image that's (almost) all neutral; "lightness" is 0-1
+	void finish(float* hue, float* lightness) const;
+};
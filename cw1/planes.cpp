@@ -0,0 +1,167 @@
+#include "planes.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define PLANES_SSE2
+#include <emmintrin.h>
+#endif
+
+/* SSSE3 isn't part of the x86-64 baseline the project is built for, so on GCC and Clang the shuffle version is compiled for it separately and only used if the CPU says it has it
+ * A build for a newer baseline ("-mssse3" or later) uses it unconditionally
+ */
+#if defined(__SSSE3__)
+#define PLANES_SSSE3
+#define PLANES_SSSE3_TARGET
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define PLANES_SSSE3
+#define PLANES_SSSE3_TARGET __attribute__((target("ssse3")))
+#endif
+
+#ifdef PLANES_SSSE3
+#include <tmmintrin.h>
+
+// which byte of each of the 16 byte loads goes to which of 16 pixels, per channel; 0x80 means none, as "pshufb" zeroes those
+typedef struct {
+    uint8_t masks[4][4][16];
+} shuffleTable;
+
+template <int Channels>
+static const shuffleTable& shufflesFor() {
+    static const shuffleTable table = []() {
+        shuffleTable built;
+        for (int channel = 0; channel < Channels; channel++)
+            for (int load = 0; load < Channels; load++)
+                for (int pixel = 0; pixel < 16; pixel++) {
+                    int byte = pixel * Channels + channel;
+                    built.masks[channel][load][pixel] = byte / 16 == load ? (uint8_t)(byte % 16) : 0x80;
+                }
+        return built;
+    }();
+    return table;
+}
+
+static bool hasSsse3() {
+#if defined(__SSSE3__)
+    return true;
+#else
+    static const bool supported = __builtin_cpu_supports("ssse3");
+    return supported;
+#endif
+}
+
+// 16 pixels at a time: "Channels" loads, then each plane is the OR of one shuffle of every load; returns how many pixels were done, the rest are left to the scalar loop
+template <int Channels>
+PLANES_SSSE3_TARGET static size_t deinterleaveShuffled(const uint8_t* pixels, const size_t count, pixelTile& tile) {
+    const shuffleTable& table = shufflesFor<Channels>();
+    __m128i masks[Channels][Channels];
+    for (int channel = 0; channel < Channels; channel++)
+        for (int load = 0; load < Channels; load++)
+            masks[channel][load] = _mm_loadu_si128((const __m128i*)table.masks[channel][load]);
+
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i loads[Channels];
+        for (int load = 0; load < Channels; load++)
+            loads[load] = _mm_loadu_si128((const __m128i*)(pixels + i * Channels + load * 16));
+
+        for (int channel = 0; channel < Channels; channel++) {
+            __m128i plane = _mm_shuffle_epi8(loads[0], masks[channel][0]);
+            for (int load = 1; load < Channels; load++)
+                plane = _mm_or_si128(plane, _mm_shuffle_epi8(loads[load], masks[channel][load]));
+            _mm_store_si128((__m128i*)(tile.planes[channel] + i), plane);
+        }
+    }
+    return i;
+}
+#endif
+
+template <int Channels>
+static void deinterleaveChannels(const uint8_t* pixels, const size_t count, pixelTile& tile) {
+    size_t i = 0;
+#ifdef PLANES_SSSE3
+    if (hasSsse3())
+        i = deinterleaveShuffled<Channels>(pixels, count, tile);
+#endif
+    for (; i < count; i++)
+        for (int channel = 0; channel < Channels; channel++)
+            tile.planes[channel][i] = pixels[i * Channels + channel];
+}
+
+void deinterleave(const uint8_t* pixels, const size_t count, const int channels, pixelTile& tile) {
+    if (channels == 4)
+        deinterleaveChannels<4>(pixels, count, tile);
+    else
+        deinterleaveChannels<3>(pixels, count, tile);
+}
+
+/* The float32 version of "hueDegrees", with every operation in the same order as the SIMD one so both give exactly the same hue
+ * The inputs are whole numbers, so the range is either 0 (grey) or at least 1
+ */
+static float planarHue(const float r, const float g, const float b) {
+    float max = r > g ? r : g;
+    max = max > b ? max : b;
+    float min = r < g ? r : g;
+    min = min < b ? min : b;
+    float delta = max - min;
+    if (delta == 0.0f)
+        return 0.0f;
+
+    float hue = r >= max ? 0.0f + (g - b) / delta : g >= max ? 2.0f + (b - r) / delta : 4.0f + (r - g) / delta;
+    hue *= 60.0f;
+    return hue < 0.0f ? hue + 360.0f : hue;
+}
+
+#ifdef PLANES_SSE2
+static inline __m128 select(const __m128 mask, const __m128 a, const __m128 b) {
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+// the "quarter"th group of 4 bytes, widened to float32
+template <int Quarter>
+static inline __m128 widen(const __m128i bytes) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i words = Quarter < 2 ? _mm_unpacklo_epi8(bytes, zero) : _mm_unpackhi_epi8(bytes, zero);
+    __m128i dwords = Quarter % 2 == 0 ? _mm_unpacklo_epi16(words, zero) : _mm_unpackhi_epi16(words, zero);
+    return _mm_cvtepi32_ps(dwords);
+}
+
+// "planarHue" without branches: all three sextant formulas are worked out and the right one is picked per lane
+static inline __m128 hues4(const __m128 r, const __m128 g, const __m128 b) {
+    const __m128 zero = _mm_setzero_ps();
+    __m128 max = _mm_max_ps(_mm_max_ps(r, g), b);
+    __m128 delta = _mm_sub_ps(max, _mm_min_ps(_mm_min_ps(r, g), b));
+
+    __m128 redMax = _mm_cmpge_ps(r, max);
+    __m128 greenMax = _mm_andnot_ps(redMax, _mm_cmpge_ps(g, max));
+    __m128 difference = select(redMax, _mm_sub_ps(g, b), select(greenMax, _mm_sub_ps(b, r), _mm_sub_ps(r, g)));
+    __m128 offset = select(redMax, zero, select(greenMax, _mm_set1_ps(2.0f), _mm_set1_ps(4.0f)));
+
+    // a grey lane divides by 1 instead of 0, and is zeroed afterwards
+    __m128 grey = _mm_cmpeq_ps(delta, zero);
+    __m128 hue = _mm_add_ps(offset, _mm_div_ps(difference, _mm_max_ps(delta, _mm_set1_ps(1.0f))));
+    hue = _mm_mul_ps(hue, _mm_set1_ps(60.0f));
+    hue = _mm_add_ps(hue, _mm_and_ps(_mm_cmplt_ps(hue, zero), _mm_set1_ps(360.0f)));
+    return _mm_andnot_ps(grey, hue);
+}
+
+template <int Quarter>
+static inline void huesQuarter(const __m128i r, const __m128i g, const __m128i b, float* out) {
+    _mm_store_ps(out + Quarter * 4, hues4(widen<Quarter>(r), widen<Quarter>(g), widen<Quarter>(b)));
+}
+#endif
+
+void planarHues(pixelTile& tile, const size_t count) {
+    size_t i = 0;
+#ifdef PLANES_SSE2
+    for (; i + 16 <= count; i += 16) {
+        __m128i r = _mm_load_si128((const __m128i*)(tile.planes[0] + i));
+        __m128i g = _mm_load_si128((const __m128i*)(tile.planes[1] + i));
+        __m128i b = _mm_load_si128((const __m128i*)(tile.planes[2] + i));
+        huesQuarter<0>(r, g, b, tile.hues + i);
+        huesQuarter<1>(r, g, b, tile.hues + i);
+        huesQuarter<2>(r, g, b, tile.hues + i);
+        huesQuarter<3>(r, g, b, tile.hues + i);
+    }
+#endif
+    for (; i < count; i++)
+        tile.hues[i] = planarHue(tile.planes[0][i], tile.planes[1][i], tile.planes[2][i]);
+}
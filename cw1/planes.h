@@ -0,0 +1,20 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// pixels per tile; a tile's planes and hues come to 16KB, so they're still in the L1 cache when the next step reads them
+#define PLANE_TILE_PIXELS 2048
+
+/* A run of pixels split out into one plane per channel, which is the layout SIMD wants: 16 reds in one register rather than 5 and a bit pixels
+ * The planes stay 8-bit, a quarter of the bandwidth of a float and an eighth of a double; kernels widen them to float32 in registers as they go
+ * Only ever a tile at a time, never a whole image, so the extra copy never leaves the cache
+ */
+typedef struct {
+	alignas(64) uint8_t planes[4][PLANE_TILE_PIXELS]; // red, green, blue, and alpha for RGBA only
+	alignas(64) float hues[PLANE_TILE_PIXELS];
+} pixelTile;
+
+// splits up to PLANE_TILE_PIXELS RGB or RGBA pixels into the tile's planes, with SSSE3 shuffles where the CPU has them
+void deinterleave(const uint8_t* pixels, size_t count, int channels, pixelTile& tile);
+// the hue of each of the first "count" pixels in the planes, in degrees, the same as "hueDegrees" but in float32 and 4 at a time
+void planarHues(pixelTile& tile, size_t count);
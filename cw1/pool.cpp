@@ -0,0 +1,56 @@
+#include "pool.h"
+
+workerPool::workerPool(const unsigned int threads) {
+    for (unsigned int i = 0; i < threads; i++)
+        this->workers.push_back(std::thread(&workerPool::work, this));
+}
+
+workerPool::~workerPool() {
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        this->stopping = true;
+    }
+    this->taskAvailable.notify_all();
+
+    for (std::thread& t : this->workers)
+        t.join();
+}
+
+void workerPool::work() {
+    std::unique_lock<std::mutex> lock(mut);
+
+    while (true) {
+        this->taskAvailable.wait(lock, [this]() { return this->stopping || !this->tasks.empty(); });
+        if (this->tasks.empty()) // only once stopping, so every task submitted before the destructor still runs
+            return;
+
+        // "top" is const, but the task is popped straight away so it's safe to move from
+        std::function<void()> run = std::move(const_cast<task&>(this->tasks.top()).run);
+        this->tasks.pop();
+        this->active++;
+
+        lock.unlock();
+        auto start = std::chrono::steady_clock::now();
+        run();
+        this->busyNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        lock.lock();
+
+        this->active--;
+        if (this->tasks.empty() && this->active == 0)
+            this->idle.notify_all();
+    }
+}
+
+void workerPool::submit(std::function<void()> run, const double cost) {
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        this->tasks.push({ cost, this->submitted++, std::move(run) });
+    }
+    this->taskAvailable.notify_one();
+}
+
+// blocks until every task submitted so far has finished
+void workerPool::wait() {
+    std::unique_lock<std::mutex> lock(mut);
+    this->idle.wait(lock, [this]() { return this->tasks.empty() && this->active == 0; });
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+/* A fixed set of worker threads taking tasks from one queue
+ * This replaces starting a thread per image and joining them in batches; tasks can be submitted from any thread (e.g. while the directory is still being scanned), and a worker never sits idle waiting for the slowest image in its batch
+ * Each task has an estimated cost and the most expensive queued task always runs next (longest-processing-time-first), so one huge image can't be left to run alone at the end
+ */
+class workerPool
+{
+private:
+	typedef struct {
+		double cost;
+		uint64_t sequence; // equal costs run in the order they were submitted
+		std::function<void()> run;
+	} task;
+
+	struct cheaperTask {
+		bool operator()(const task& a, const task& b) const { return a.cost < b.cost || (a.cost == b.cost && a.sequence > b.sequence); }
+	};
+
+	std::vector<std::thread> workers;
+	std::priority_queue<task, std::vector<task>, cheaperTask> tasks;
+	uint64_t submitted = 0;
+	size_t active = 0; // tasks being run right now
+	bool stopping = false;
+	std::atomic<int64_t> busyNanoseconds{ 0 }; // total time workers have spent running tasks
+	std::mutex mut;
+	std::condition_variable taskAvailable;
+	std::condition_variable idle;
+
+	void work();
+public:
+	workerPool(unsigned int threads);
+	~workerPool();
+	workerPool(const workerPool&) = delete;
+	workerPool& operator=(const workerPool&) = delete;
+	void submit(std::function<void()> run, double cost);
+	void wait();
+	[[nodiscard]] size_t size() const { return workers.size(); }
+	[[nodiscard]] std::chrono::nanoseconds getBusyTime() const { return std::chrono::nanoseconds(busyNanoseconds.load()); }
+};
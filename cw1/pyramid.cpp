@@ -0,0 +1,238 @@
+#include "pyramid.h"
+#include <algorithm>
+#include <cstring>
+#include "decoder.h"
+#include "io.h"
+
+/* Takes a decoder's bands straight into the pyramid's level 0 tiles, so the image is never held whole as well
+ * If level 0 is smaller than the image ("shift" halvings), each block of source pixels is box filtered into one as its rows arrive; only one output row's sums are kept
+ */
+class pyramidWriter : public bandSink
+{
+private:
+	tiledPyramid& pyramid;
+	const std::atomic<bool>& stop;
+	const unsigned int shift;
+	unsigned int sourceWidth = 0;
+	unsigned int sourceHeight = 0;
+	unsigned int sourceRow = 0;
+	unsigned int written = 0;
+	bool matches = true;
+	std::vector<uint64_t> sums; // per channel of the output row being built
+	std::vector<uint8_t> row;
+
+	void finishRow() {
+		const unsigned int n = this->pyramid.getChannels();
+		const unsigned int rows = this->sourceRow - (this->written << this->shift);
+		for (unsigned int x = 0; x < this->pyramid.getWidth(0); x++) {
+			const unsigned int columns = std::min(1u << this->shift, this->sourceWidth - (x << this->shift));
+			for (unsigned int c = 0; c < n; c++)
+				this->row[(size_t)x * n + c] = (uint8_t)((this->sums[(size_t)x * n + c] + rows * columns / 2) / (rows * columns));
+		}
+		this->pyramid.addRows(this->row.data(), this->written++, 1);
+		std::fill(this->sums.begin(), this->sums.end(), 0);
+	}
+public:
+	pyramidWriter(tiledPyramid& _pyramid, const std::atomic<bool>& _stop, const unsigned int _shift) : pyramid(_pyramid), stop(_stop), shift(_shift) {}
+	void begin(int width, int height, int channels) override {
+		this->sourceWidth = (unsigned int)width;
+		this->sourceHeight = (unsigned int)height;
+		this->matches = ((this->sourceWidth + (1u << this->shift) - 1) >> this->shift) == this->pyramid.getWidth(0) && ((this->sourceHeight + (1u << this->shift) - 1) >> this->shift) == this->pyramid.getHeight(0)
+			&& (unsigned int)channels == this->pyramid.getChannels();
+		this->sums.assign((size_t)this->pyramid.getWidth(0) * this->pyramid.getChannels(), 0);
+		this->row.resize(this->sums.size());
+	}
+	void addRows(const uint8_t* rows, int count) override {
+		if (!this->matches)
+			return;
+		if (this->shift == 0) {
+			this->pyramid.addRows(rows, this->written, (unsigned int)count);
+			this->written += (unsigned int)count;
+			this->sourceRow += (unsigned int)count;
+			return;
+		}
+
+		const unsigned int n = this->pyramid.getChannels();
+		for (int y = 0; y < count; y++) {
+			const uint8_t* source = rows + (size_t)y * this->sourceWidth * n;
+			for (unsigned int x = 0; x < this->sourceWidth; x++)
+				for (unsigned int c = 0; c < n; c++)
+					this->sums[(size_t)(x >> this->shift) * n + c] += source[(size_t)x * n + c];
+			this->sourceRow++;
+			if ((this->sourceRow & ((1u << this->shift) - 1)) == 0 || this->sourceRow == this->sourceHeight)
+				this->finishRow();
+		}
+	}
+	[[nodiscard]] bool cancelled() const override { return stop; }
+	[[nodiscard]] bool complete() const { return matches && written == pyramid.getHeight(0); }
+};
+
+tiledPyramid::tiledPyramid(const unsigned int width, const unsigned int height, const unsigned int _channels) : channels(_channels) {
+    this->levels.push_back(emptyLevel(width, height, _channels));
+}
+
+tiledPyramid::~tiledPyramid() {
+    if (this->budget != nullptr)
+        this->budget->release(this->reserved);
+}
+
+// a level's tiles, sized but not filled in
+tiledPyramid::level tiledPyramid::emptyLevel(const unsigned int width, const unsigned int height, const unsigned int channels) {
+    level empty;
+    empty.width = width;
+    empty.height = height;
+    empty.columns = (width + PYRAMID_TILE_SIZE - 1) / PYRAMID_TILE_SIZE;
+    empty.rows = (height + PYRAMID_TILE_SIZE - 1) / PYRAMID_TILE_SIZE;
+    empty.tiles.resize((size_t)empty.columns * empty.rows);
+
+    for (unsigned int row = 0; row < empty.rows; row++)
+        for (unsigned int column = 0; column < empty.columns; column++) {
+            bitmap& tile = empty.tiles[(size_t)row * empty.columns + column];
+            tile.width = std::min((unsigned int)PYRAMID_TILE_SIZE, width - column * PYRAMID_TILE_SIZE);
+            tile.height = std::min((unsigned int)PYRAMID_TILE_SIZE, height - row * PYRAMID_TILE_SIZE);
+            tile.pixels.resize((size_t)tile.width * tile.height * channels);
+        }
+    return empty;
+}
+
+// the bytes of every level's tiles, which is what "fromFile" reserves from the budget before building one
+uint64_t tiledPyramid::footprint(unsigned int width, unsigned int height, const unsigned int channels) {
+    uint64_t bytes = (uint64_t)width * height * channels;
+    while (width > PYRAMID_TILE_SIZE || height > PYRAMID_TILE_SIZE) {
+        width = std::max(1u, (width + 1) / 2);
+        height = std::max(1u, (height + 1) / 2);
+        bytes += (uint64_t)width * height * channels;
+    }
+    return bytes;
+}
+
+// level 0 is a straight copy of the pixels, a row of a tile at a time
+void tiledPyramid::addRows(const uint8_t* pixels, const unsigned int firstRow, const unsigned int count) {
+    level& full = this->levels.front();
+    const size_t stride = (size_t)full.width * this->channels;
+
+    for (unsigned int y = firstRow; y < std::min(full.height, firstRow + count); y++) {
+        const uint8_t* source = pixels + (size_t)(y - firstRow) * stride;
+        const unsigned int row = y / PYRAMID_TILE_SIZE;
+        for (unsigned int column = 0; column < full.columns; column++) {
+            bitmap& tile = full.tiles[(size_t)row * full.columns + column];
+            const size_t tileStride = (size_t)tile.width * this->channels;
+            memcpy(&tile.pixels[(y % PYRAMID_TILE_SIZE) * tileStride], source + (size_t)column * PYRAMID_TILE_SIZE * this->channels, tileStride);
+        }
+    }
+}
+
+void tiledPyramid::addHalfLevels() {
+    while (this->levels.back().columns > 1 || this->levels.back().rows > 1)
+        this->addHalfLevel();
+}
+
+/* Builds the next level from the last one with a 2x2 box filter
+ * As the tile size is even, each tile of the new level is made from exactly (up to) four tiles of the last, so this never needs the level as one image
+ */
+void tiledPyramid::addHalfLevel() {
+    const level& source = this->levels.back();
+    const unsigned int n = this->channels;
+    level half = emptyLevel(std::max(1u, (source.width + 1) / 2), std::max(1u, (source.height + 1) / 2), n);
+
+    for (unsigned int row = 0; row < half.rows; row++)
+        for (unsigned int column = 0; column < half.columns; column++) {
+            bitmap& tile = half.tiles[(size_t)row * half.columns + column];
+
+            for (unsigned int quarter = 0; quarter < 4; quarter++) {
+                unsigned int childColumn = column * 2 + (quarter & 1), childRow = row * 2 + (quarter >> 1);
+                if (childColumn >= source.columns || childRow >= source.rows)
+                    continue;
+
+                const bitmap& child = source.tiles[(size_t)childRow * source.columns + childColumn];
+                unsigned int offsetX = (quarter & 1) * (PYRAMID_TILE_SIZE / 2), offsetY = (quarter >> 1) * (PYRAMID_TILE_SIZE / 2);
+
+                for (unsigned int y = 0; y < (child.height + 1) / 2; y++) {
+                    // an odd edge pixel is averaged with itself
+                    const uint8_t* row0 = &child.pixels[(size_t)(y * 2) * child.width * n];
+                    const uint8_t* row1 = &child.pixels[(size_t)std::min(y * 2 + 1, child.height - 1) * child.width * n];
+                    uint8_t* dst = &tile.pixels[((size_t)(offsetY + y) * tile.width + offsetX) * n];
+
+                    for (unsigned int x = 0; x < (child.width + 1) / 2; x++, dst += n) {
+                        unsigned int x0 = x * 2 * n, x1 = std::min(x * 2 + 1, child.width - 1) * n;
+                        for (unsigned int c = 0; c < n; c++)
+                            dst[c] = (uint8_t)((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) / 4);
+                    }
+                }
+            }
+        }
+
+    this->levels.push_back(std::move(half));
+}
+
+/* Reads and decodes the file through the decoder registry, a band at a time straight into the tiles where the backend can stream (libjpeg-turbo's JPEGs)
+ * Every level is reserved from "budget" first and held until the pyramid is destroyed, so a zoomed gigapixel image counts against the same limit as the loading threads
+ * Level 0 is halved until the whole pyramid fits in 1 / PYRAMID_BUDGET_SHARE of the budget; the closest zoom is softer for it, but the full decoded size is never held
+ * The reservation never waits: if the loading threads have the budget, this gives back null and the viewer stays on the stretched preview until the next zoom asks again
+ * A file no backend can stream is decoded whole, which needs the whole image reserved on top of the pyramid for as long as that takes, so level 0 is halved until both fit its share (and if the decode alone doesn't, there's no pyramid)
+ * "cancelled" is checked between bands, and gives back null (and all it reserved) as soon as it's seen; a decode that can't stream can't be stopped part way
+ */
+std::shared_ptr<tiledPyramid> tiledPyramid::fromFile(const std::string& path, std::shared_ptr<memoryBudget> budget, const std::atomic<bool>& cancelled) {
+    std::vector<uint8_t> fileData;
+    if (!readFile(path, fileData))
+        return nullptr;
+
+    int width, height, channels;
+    std::string error;
+    if (!decoders().info(fileData.data(), fileData.size(), &width, &height, &channels, &error))
+        return nullptr;
+
+    // halve level 0 until it fits the pyramid's share of the budget alongside "extra" bytes, then reserve both
+    const uint64_t share = budget->getLimit() / PYRAMID_BUDGET_SHARE;
+    unsigned int shift = 0;
+    auto reduced = [&shift](int size) { return ((unsigned int)size + (1u << shift) - 1) >> shift; };
+    auto reserve = [&](uint64_t extra) -> std::shared_ptr<tiledPyramid> {
+        shift = 0;
+        while (footprint(reduced(width), reduced(height), (unsigned int)channels) + extra > share && (reduced(width) > PYRAMID_TILE_SIZE || reduced(height) > PYRAMID_TILE_SIZE))
+            shift++;
+        const uint64_t bytes = footprint(reduced(width), reduced(height), (unsigned int)channels);
+        if (bytes + extra > share && extra != 0)
+            return nullptr;
+        if (!budget->tryAcquire(bytes + extra))
+            return nullptr;
+        std::shared_ptr<tiledPyramid> pyramid = std::make_shared<tiledPyramid>(reduced(width), reduced(height), (unsigned int)channels);
+        pyramid->budget = budget;
+        pyramid->reserved = bytes;
+        return pyramid;
+    };
+
+    std::shared_ptr<tiledPyramid> pyramid = reserve(0);
+    if (!pyramid)
+        return nullptr;
+
+    pyramidWriter writer(*pyramid, cancelled, shift);
+    if (!decoders().decodeBands(fileData.data(), fileData.size(), writer, &error) || !writer.complete()) {
+        if (cancelled)
+            return nullptr;
+
+        // the whole decode has to fit the share too, so give the pyramid back and reserve the two together
+        const uint64_t decodeBytes = (uint64_t)width * height * channels;
+        pyramid.reset();
+        pyramid = reserve(decodeBytes);
+        if (!pyramid)
+            return nullptr;
+
+        bool decodedFile;
+        {
+            decodedImage decoded;
+            decodedFile = decoders().decode(fileData.data(), fileData.size(), decoded, &error) && decoded.width == width && decoded.height == height && decoded.channels == channels;
+            if (decodedFile) {
+                pyramidWriter whole(*pyramid, cancelled, shift);
+                whole.begin(width, height, channels);
+                whole.addRows(decoded.pixels.data(), height);
+                decodedFile = whole.complete();
+            }
+        }
+        budget->release(decodeBytes);
+        if (!decodedFile || cancelled)
+            return nullptr;
+    }
+
+    pyramid->addHalfLevels();
+    return pyramid;
+}
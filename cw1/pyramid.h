@@ -0,0 +1,55 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "budget.h"
+#include "image.h"
+
+#define PYRAMID_TILE_SIZE 256
+// a pyramid takes at most this share of the memory budget (1 / n), so the loading threads always keep the rest
+#define PYRAMID_BUDGET_SHARE 2
+
+/* A mip pyramid of an image cut into PYRAMID_TILE_SIZE square tiles, for zooming and panning images far bigger than the screen (or a texture)
+ * Level 0 is full resolution (or halved until the pyramid fits its share of the budget, see "fromFile") and each level after it is half the size of the one before, down to the first level that fits in one tile
+ * The viewer only uploads the tiles of the one level that matches the current zoom and intersect the screen, so texture memory doesn't depend on the image size
+ * Tiles keep the file's own channels (1 to 4) rather than being expanded to RGBA, so unlike other "bitmap"s they're only RGBA for an RGBA file; the viewer expands a tile when it uploads it
+ */
+class tiledPyramid
+{
+private:
+	typedef struct {
+		unsigned int width;
+		unsigned int height;
+		unsigned int columns;
+		unsigned int rows;
+		std::vector<bitmap> tiles; // row-major, edge tiles are smaller than PYRAMID_TILE_SIZE
+	} level;
+
+	std::vector<level> levels;
+	unsigned int channels;
+	// the pyramid's pixels are reserved from the same budget as the loading threads' decodes, and given back when it's destroyed
+	std::shared_ptr<memoryBudget> budget;
+	uint64_t reserved = 0;
+
+	static level emptyLevel(unsigned int width, unsigned int height, unsigned int channels);
+	void addHalfLevel();
+public:
+	tiledPyramid(unsigned int width, unsigned int height, unsigned int _channels);
+	~tiledPyramid();
+	tiledPyramid(const tiledPyramid&) = delete;
+	tiledPyramid& operator=(const tiledPyramid&) = delete;
+	static uint64_t footprint(unsigned int width, unsigned int height, unsigned int channels);
+	static std::shared_ptr<tiledPyramid> fromFile(const std::string& path, std::shared_ptr<memoryBudget> budget, const std::atomic<bool>& cancelled);
+	// level 0 is filled "count" rows at a time from the top (e.g. a decoder's bands), and the smaller levels are made from it once it's all there
+	void addRows(const uint8_t* pixels, unsigned int firstRow, unsigned int count);
+	void addHalfLevels();
+	[[nodiscard]] int levelCount() const { return (int)levels.size(); }
+	[[nodiscard]] unsigned int getChannels() const { return channels; }
+	[[nodiscard]] unsigned int getWidth(int lvl) const { return levels[lvl].width; }
+	[[nodiscard]] unsigned int getHeight(int lvl) const { return levels[lvl].height; }
+	[[nodiscard]] unsigned int getColumns(int lvl) const { return levels[lvl].columns; }
+	[[nodiscard]] unsigned int getRows(int lvl) const { return levels[lvl].rows; }
+	[[nodiscard]] const bitmap& getTile(int lvl, unsigned int column, unsigned int row) const { return levels[lvl].tiles[(size_t)row * levels[lvl].columns + column]; }
+};
@@ -0,0 +1,129 @@
+#include "radixsort.h"
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+// 11 bits a pass is 6 passes rather than a byte's 8, and a thread's 2048 counts (16KB) still fit in the L1 cache
+#define RADIX_BITS 11
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+#define RADIX_PASSES ((64 + RADIX_BITS - 1) / RADIX_BITS)
+#define SIGN_BIT 0x8000000000000000ull
+
+// holds each thread in "wait" until every one of them has got there, so no thread starts a pass before the others have finished the last
+class passBarrier
+{
+private:
+    std::mutex mut;
+    std::condition_variable released;
+    const unsigned int threads;
+    unsigned int waiting = 0;
+    uint64_t generation = 0; // which "wait" this is, so a thread woken late can't mistake the next one for its own
+public:
+    explicit passBarrier(const unsigned int _threads) : threads(_threads) {}
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(mut);
+        const uint64_t arrived = this->generation;
+        if (++this->waiting == this->threads) {
+            this->waiting = 0;
+            this->generation++;
+            this->released.notify_all();
+            return;
+        }
+        this->released.wait(lock, [this, arrived]() { return this->generation != arrived; });
+    }
+};
+
+void radixSort(std::vector<uint64_t>& keys, std::vector<uint32_t>& ids, unsigned int threads) {
+    const size_t count = keys.size();
+    if (count < 2)
+        return;
+    // every thread gets at least RADIX_PARALLEL_KEYS keys, so a small sort is one thread
+    threads = (unsigned int)std::max<size_t>(1, std::min<size_t>(threads, count / RADIX_PARALLEL_KEYS));
+
+    std::vector<uint64_t> keyBuffer(count);
+    std::vector<uint32_t> idBuffer(count);
+    std::vector<size_t> counts((size_t)threads * RADIX_BUCKETS); // per thread, per bucket
+    std::vector<uint64_t> differing(threads, 0); // the bits each thread's run has that aren't the same as the first key's
+    passBarrier barrier(threads);
+
+    auto sortRun = [&](const unsigned int t) {
+        const size_t first = count * t / threads, last = count * (t + 1) / threads;
+
+        uint64_t differs = 0;
+        for (size_t i = first; i < last; i++)
+            differs |= keys[i] ^ keys[0];
+        differing[t] = differs;
+        barrier.wait();
+        differs = 0;
+        for (uint64_t d : differing)
+            differs |= d;
+
+        uint64_t* from = keys.data();
+        uint64_t* to = keyBuffer.data();
+        uint32_t* fromIds = ids.data();
+        uint32_t* toIds = idBuffer.data();
+        for (int pass = 0; pass < RADIX_PASSES; pass++) {
+            const int shift = pass * RADIX_BITS;
+            if (((differs >> shift) & (RADIX_BUCKETS - 1)) == 0) // every thread sees the same "differs", so they all skip the same passes
+                continue;
+
+            size_t* mine = counts.data() + (size_t)t * RADIX_BUCKETS;
+            std::fill(mine, mine + RADIX_BUCKETS, 0);
+            for (size_t i = first; i < last; i++)
+                mine[(from[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+            barrier.wait();
+
+            // this thread's share of a bucket goes after every smaller bucket, and after the earlier threads' shares of the same one, which is what keeps it stable
+            size_t offsets[RADIX_BUCKETS];
+            size_t start = 0;
+            for (int bucket = 0; bucket < RADIX_BUCKETS; bucket++)
+                for (unsigned int u = 0; u < threads; u++) {
+                    if (u == t)
+                        offsets[bucket] = start;
+                    start += counts[(size_t)u * RADIX_BUCKETS + bucket];
+                }
+
+            for (size_t i = first; i < last; i++) {
+                const size_t position = offsets[(from[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+                to[position] = from[i];
+                toIds[position] = fromIds[i];
+            }
+            barrier.wait(); // before anyone reads what the others moved, or counts over "counts" for the next pass
+
+            std::swap(from, to);
+            std::swap(fromIds, toIds);
+        }
+
+        // an odd number of passes (not counting skipped ones) leaves the result in the buffers
+        if (from != keys.data()) {
+            std::copy(from + first, from + last, keys.data() + first);
+            std::copy(fromIds + first, fromIds + last, ids.data() + first);
+        }
+    };
+
+    // the calling thread takes the first run rather than waiting
+    std::vector<std::thread> helpers;
+    for (unsigned int t = 1; t < threads; t++)
+        helpers.push_back(std::thread(sortRun, t));
+    sortRun(0);
+    for (std::thread& helper : helpers)
+        helper.join();
+}
+
+uint64_t orderedBits(double value) {
+    value += 0.0; // -0 becomes +0, so the two are equal here as they are as doubles
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    // negative numbers count down as their bits go up, so they're flipped; positive ones just go above them
+    return bits & SIGN_BIT ? ~bits : bits | SIGN_BIT;
+}
+
+double fromOrderedBits(uint64_t bits) {
+    bits = bits & SIGN_BIT ? bits & ~SIGN_BIT : ~bits;
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// below this many keys a sort stays on the calling thread, starting threads would take longer than the sort
+#define RADIX_PARALLEL_KEYS 65536
+
+/* Sorts "keys" ascending with a least-significant-digit radix sort, 11 bits per pass, moving "ids" along with them
+ * It's stable, so equal keys keep the order they came in; and the result doesn't depend on how many threads there were
+ * Each pass splits the keys into one run per thread: every thread counts its run's digits, works out where its share of each bucket starts, and moves its run there
+ * A digit that's the same in every key is skipped, as the pass would move nothing
+ */
+void radixSort(std::vector<uint64_t>& keys, std::vector<uint32_t>& ids, unsigned int threads);
+
+// a double's bits rearranged so that comparing them as unsigned integers orders them the same as the doubles, and back
+uint64_t orderedBits(double value);
+double fromOrderedBits(uint64_t bits);
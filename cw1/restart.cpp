@@ -0,0 +1,247 @@
+#include "restart.h"
+
+#ifdef HAVE_LIBJPEG
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+static uint16_t readBigEndian(const uint8_t* at) {
+    return (uint16_t)(at[0] << 8 | at[1]);
+}
+
+/* Reads the headers and finds every RST marker in the (single) scan
+ * Only a baseline or extended sequential Huffman JPEG with one interleaved scan can be split, and only if every restart interval is a whole number of MCU rows, so each one starts at the left edge of a row
+ * Anything else (progressive, arithmetic coding, several scans, no or misaligned restarts) is left to the normal decode
+ */
+bool parseRestartIntervals(const uint8_t* data, const size_t size, restartLayout& layout) {
+    if (size < 4 || data[0] != 0xFF || data[1] != 0xD8)
+        return false;
+
+    unsigned int restartInterval = 0, maxH = 1, maxV = 1;
+    bool frame = false;
+    size_t position = 2;
+
+    while (true) {
+        if (position + 4 > size || data[position] != 0xFF)
+            return false;
+
+        uint8_t marker = data[position + 1];
+        if (marker == 0xFF) {
+            position++;
+            continue;
+        }
+
+        size_t length = readBigEndian(data + position + 2);
+        if (length < 2 || position + 2 + length > size)
+            return false;
+        const uint8_t* segment = data + position + 4;
+
+        if (marker == 0xC0 || marker == 0xC1) {
+            if (length < 8)
+                return false;
+            layout.heightOffset = position + 5;
+            layout.height = readBigEndian(segment + 1);
+            layout.width = readBigEndian(segment + 3);
+            unsigned int components = segment[5];
+            if (components == 0 || length < 8 + components * 3)
+                return false;
+            for (unsigned int c = 0; c < components; c++) {
+                maxH = std::max(maxH, (unsigned int)(segment[6 + c * 3 + 1] >> 4));
+                maxV = std::max(maxV, (unsigned int)(segment[6 + c * 3 + 1] & 15));
+            }
+            frame = true;
+        }
+        else if (marker >= 0xC2 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC)
+            return false; // progressive, lossless or arithmetic coded
+        else if (marker == 0xDD && length >= 4)
+            restartInterval = readBigEndian(segment);
+        else if (marker == 0xDA) {
+            layout.headerEnd = position + 2 + length;
+            break;
+        }
+
+        position += 2 + length;
+    }
+
+    if (!frame || restartInterval == 0 || layout.width == 0 || layout.height == 0)
+        return false;
+
+    const unsigned int mcusPerRow = (layout.width + 8 * maxH - 1) / (8 * maxH);
+    const unsigned int mcuRows = (layout.height + 8 * maxV - 1) / (8 * maxV);
+    if (restartInterval % mcusPerRow != 0)
+        return false;
+    layout.mcuHeight = 8 * maxV;
+    layout.mcuRowsPerInterval = restartInterval / mcusPerRow;
+
+    // 0xFF 0x00 is a stuffed 0xFF in the data, 0xFF 0xD0-0xD7 is a restart marker, and anything else ends the scan
+    size_t start = layout.headerEnd;
+    for (position = layout.headerEnd; position + 1 < size; position++) {
+        if (data[position] != 0xFF || data[position + 1] == 0x00 || data[position + 1] == 0xFF)
+            continue;
+
+        layout.intervals.push_back({ start, position });
+        if (data[position + 1] >= 0xD0 && data[position + 1] <= 0xD7) {
+            start = position + 2;
+            position++;
+            continue;
+        }
+        if (data[position + 1] != 0xD9) // another scan follows
+            return false;
+        break;
+    }
+
+    return layout.intervals.size() == (mcuRows + layout.mcuRowsPerInterval - 1) / layout.mcuRowsPerInterval;
+}
+
+/* Up to "pieceCount" pieces of (nearly) equal numbers of intervals, each with the interval either side of it for context
+ * A piece that would have no rows of its own (past the bottom of the image) is left out, so there may be fewer
+ */
+std::vector<restartPiece> splitRestartIntervals(const restartLayout& layout, const size_t pieceCount) {
+    const size_t intervals = layout.intervals.size();
+    const unsigned int intervalRows = layout.mcuRowsPerInterval * layout.mcuHeight;
+    const size_t count = std::min(intervals, pieceCount);
+    std::vector<restartPiece> pieces;
+    for (size_t p = 0; p < count; p++) {
+        size_t first = intervals * p / count;
+        size_t last = intervals * (p + 1) / count;
+        unsigned int firstRow = (unsigned int)first * intervalRows;
+        unsigned int lastRow = std::min(layout.height, (unsigned int)last * intervalRows);
+        if (firstRow >= lastRow)
+            continue;
+        size_t edgeFirst = first > 0 ? first - 1 : first;
+        size_t edgeLast = std::min(intervals, last + 1);
+        pieces.push_back({ edgeFirst, edgeLast, (unsigned int)(first - edgeFirst) * intervalRows, firstRow, lastRow - firstRow });
+    }
+    return pieces;
+}
+
+/* A JPEG of its own for a piece: the original headers with the height cut down, then the piece's intervals with their restart markers renumbered from RST0
+ * The intervals don't depend on anything before them (DC prediction resets at every restart), so the piece decodes to exactly those rows of the image
+ */
+std::vector<uint8_t> buildPiece(const uint8_t* data, const restartLayout& layout, const restartPiece& piece) {
+    std::vector<uint8_t> jpeg(data, data + layout.headerEnd);
+    const unsigned int rows = std::min(layout.height - (piece.firstRow - piece.skippedRows), (unsigned int)(piece.lastInterval - piece.firstInterval) * layout.mcuRowsPerInterval * layout.mcuHeight);
+    jpeg[layout.heightOffset] = (uint8_t)(rows >> 8);
+    jpeg[layout.heightOffset + 1] = (uint8_t)(rows & 0xFF);
+
+    for (size_t i = piece.firstInterval; i < piece.lastInterval; i++) {
+        if (i > piece.firstInterval) {
+            jpeg.push_back(0xFF);
+            jpeg.push_back((uint8_t)(0xD0 + (i - piece.firstInterval - 1) % 8));
+        }
+        const restartInterval& interval = layout.intervals[i];
+        jpeg.insert(jpeg.end(), data + interval.start, data + interval.end);
+    }
+
+    jpeg.push_back(0xFF);
+    jpeg.push_back(0xD9);
+    return jpeg;
+}
+
+// copies each decoded band into its rows of the full image
+class pieceWriter : public bandSink
+{
+private:
+	uint8_t* destination;
+	size_t stride;
+	unsigned int skipRows;
+	unsigned int maxRows;
+	unsigned int written = 0;
+public:
+	pieceWriter(uint8_t* _destination, size_t _stride, unsigned int _skipRows, unsigned int _maxRows) : destination(_destination), stride(_stride), skipRows(_skipRows), maxRows(_maxRows) {}
+	void begin(int, int, int) override {}
+	void addRows(const uint8_t* rows, int count) override {
+		unsigned int skipped = std::min((unsigned int)count, this->skipRows);
+		this->skipRows -= skipped;
+		unsigned int copied = std::min((unsigned int)count - skipped, this->maxRows - this->written);
+		memcpy(this->destination + this->written * this->stride, rows + skipped * this->stride, copied * this->stride);
+		this->written += copied;
+	}
+	[[nodiscard]] unsigned int getWritten() const { return written; }
+};
+
+// shared by the thread that asked for the decode and the pool workers helping it
+typedef struct {
+    const uint8_t* data;
+    restartLayout layout;
+    std::vector<restartPiece> pieces;
+    uint8_t* pixels;
+    size_t stride;
+    std::atomic<size_t> next{ 0 };
+    std::atomic<size_t> remaining{ 0 };
+    std::atomic<bool> failed{ false };
+    std::mutex mut;
+    std::condition_variable finished;
+} restartDecode;
+
+// takes pieces until there are none left; a helper that starts after they've all been taken just returns
+static void decodePieces(std::shared_ptr<restartDecode> decode) {
+    const jpegDecoder decoder;
+    size_t i;
+    while ((i = decode->next++) < decode->pieces.size()) {
+        const restartPiece& piece = decode->pieces[i];
+        std::vector<uint8_t> jpeg = buildPiece(decode->data, decode->layout, piece);
+
+        pieceWriter writer(decode->pixels + (size_t)piece.firstRow * decode->stride, decode->stride, piece.skippedRows, piece.rows);
+        std::string error;
+        if (!decoder.decodeBands(jpeg.data(), jpeg.size(), writer, &error) || writer.getWritten() != piece.rows)
+            decode->failed = true;
+
+        if (--decode->remaining == 0) {
+            std::lock_guard<std::mutex> lock(decode->mut);
+            decode->finished.notify_all();
+        }
+    }
+}
+
+/* Decodes a big JPEG's restart intervals in parallel, each piece into its own rows of "out"
+ * The calling thread decodes pieces too, and can finish every one of them by itself if the pool is busy, so waiting here never deadlocks a worker
+ * The helpers are queued ahead of everything else, as finishing this image sooner is the whole point
+ */
+bool decodeRestartIntervals(const uint8_t* data, const size_t size, decodedImage& out, workerPool& pool, std::string* error) {
+    std::shared_ptr<restartDecode> decode = std::make_shared<restartDecode>();
+    decode->data = data;
+    if (!parseRestartIntervals(data, size, decode->layout)) {
+        *error = "no usable restart markers";
+        return false;
+    }
+
+    int width, height, channels;
+    const jpegDecoder decoder;
+    if (!decoder.info(data, size, &width, &height, &channels, error))
+        return false;
+
+    // two pieces per thread, so one slow piece doesn't hold up the rest without paying for too many edge intervals
+    decode->pieces = splitRestartIntervals(decode->layout, (pool.size() + 1) * 2);
+    if (decode->pieces.size() < 2) {
+        *error = "too few restart intervals to split";
+        return false;
+    }
+
+    out.width = width;
+    out.height = height;
+    out.channels = channels;
+    out.pixels.resize((size_t)width * height * channels);
+    decode->pixels = out.pixels.data();
+    decode->stride = (size_t)width * channels;
+    decode->remaining = decode->pieces.size();
+
+    for (size_t p = 1; p < decode->pieces.size(); p++)
+        pool.submit([decode]() { decodePieces(decode); }, std::numeric_limits<double>::max());
+    decodePieces(decode);
+
+    std::unique_lock<std::mutex> lock(decode->mut);
+    decode->finished.wait(lock, [&decode]() { return decode->remaining == 0; });
+
+    if (decode->failed) {
+        *error = "a restart interval failed to decode";
+        return false;
+    }
+    return true;
+}
+#endif
@@ -0,0 +1,46 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "decoder.h"
+#include "pool.h"
+
+// below this many pixels an image decodes quickly enough on one thread that splitting it up isn't worth it
+#define PARALLEL_DECODE_PIXELS (16 * 1000 * 1000)
+
+#ifdef HAVE_LIBJPEG
+// one restart interval's entropy-coded data, without the RST marker that ends it
+typedef struct {
+	size_t start;
+	size_t end;
+} restartInterval;
+
+// what's needed from a JPEG's headers to split it, see "parseRestartIntervals"
+typedef struct {
+	size_t headerEnd; // where the entropy-coded data starts, right after the SOS segment
+	size_t heightOffset; // of the SOF's 2 byte height, which each piece gets its own value for
+	unsigned int width;
+	unsigned int height;
+	unsigned int mcuHeight; // in pixels
+	unsigned int mcuRowsPerInterval;
+	std::vector<restartInterval> intervals;
+} restartLayout;
+
+/* A band of rows decoded from some of the intervals, straight into its place in the full image
+ * Fancy chroma upsampling looks at the chroma row either side, so a piece also decodes the interval either side of its own and throws those rows away; that way the seams come out the same as a single-threaded decode
+ */
+typedef struct {
+	size_t firstInterval; // including the one decoded only for its edge
+	size_t lastInterval; // one past, also including the edge
+	unsigned int skippedRows; // decoded only as context for upsampling
+	unsigned int firstRow;
+	unsigned int rows;
+} restartPiece;
+
+bool parseRestartIntervals(const uint8_t* data, size_t size, restartLayout& layout);
+std::vector<restartPiece> splitRestartIntervals(const restartLayout& layout, size_t pieceCount);
+std::vector<uint8_t> buildPiece(const uint8_t* data, const restartLayout& layout, const restartPiece& piece);
+
+bool decodeRestartIntervals(const uint8_t* data, size_t size, decodedImage& out, workerPool& pool, std::string* error);
+#endif
@@ -0,0 +1,154 @@
+#include "scanner.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <thread>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#include <filesystem>
+#endif
+
+// the formats stb_image can decode
+static const char* IMAGE_EXTENSIONS[] = { "jpg", "jpeg", "jpe", "png", "bmp", "gif", "psd", "tga", "hdr", "pic", "pnm", "ppm", "pgm" };
+
+/* Files are picked by extension, which needs nothing but the name
+ * Only files with no extension at all have their first few bytes read, so sidecar files (.xmp, .txt, ...) in a big tree never get opened
+ */
+bool isImageFile(const std::string& path, const char* name) {
+    const char* dot = strrchr(name, '.');
+    if (dot != nullptr) {
+        std::string extension(dot + 1);
+        std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+        for (const char* known : IMAGE_EXTENSIONS)
+            if (extension == known)
+                return true;
+        return false;
+    }
+
+    unsigned char magic[8] = { 0 };
+    std::ifstream file(path, std::ios::binary);
+    if (!file.read(reinterpret_cast<char*>(magic), sizeof(magic)) && file.gcount() < 4)
+        return false;
+
+    return (magic[0] == 0xFF && magic[1] == 0xD8 && magic[2] == 0xFF) // JPEG
+        || memcmp(magic, "\x89PNG", 4) == 0
+        || memcmp(magic, "GIF8", 4) == 0
+        || memcmp(magic, "8BPS", 4) == 0 // PSD
+        || (magic[0] == 'B' && magic[1] == 'M')
+        || memcmp(magic, "#?RA", 4) == 0 || memcmp(magic, "#?RG", 4) == 0 // HDR
+        || (magic[0] == 'P' && (magic[1] == '5' || magic[1] == '6'));
+}
+
+void directoryScanner::foundFile(const std::string& path, const char* name, const uint64_t inode) {
+    if (isImageFile(path, name))
+        this->onFile(path, inode);
+}
+
+#ifdef __linux__
+// the layout "getdents64" fills the buffer with, glibc doesn't declare it
+typedef struct {
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+} linuxDirent64;
+
+void directoryScanner::readDirectory(const std::string& directory, std::vector<std::string>& subdirectories) {
+    int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+
+    // 64KB holds a few hundred to a couple of thousand entries, so even a huge directory only takes a handful of system calls
+    std::vector<char> buffer(64 * 1024);
+    long bytes;
+    while ((bytes = syscall(SYS_getdents64, fd, buffer.data(), buffer.size())) > 0) {
+        for (long offset = 0; offset < bytes;) {
+            const linuxDirent64* entry = reinterpret_cast<const linuxDirent64*>(buffer.data() + offset);
+            offset += entry->d_reclen;
+
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+                continue;
+
+            std::string path = directory + '/' + entry->d_name;
+            unsigned char type = entry->d_type;
+
+            // a few filesystems don't fill in the type, only then is a stat needed
+            if (type == DT_UNKNOWN) {
+                struct stat st;
+                if (lstat(path.c_str(), &st) != 0)
+                    continue;
+                type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+            }
+
+            if (type == DT_DIR)
+                subdirectories.push_back(std::move(path));
+            else if (type == DT_REG)
+                this->foundFile(path, entry->d_name, entry->d_ino);
+        }
+    }
+
+    close(fd);
+}
+#else
+void directoryScanner::readDirectory(const std::string& directory, std::vector<std::string>& subdirectories) {
+    namespace fs = std::filesystem;
+
+    // on Windows the entry's type comes from the same FindNextFile call as its name, so this doesn't stat each file either
+    std::error_code ec;
+    for (fs::directory_iterator dirItr(directory, ec), endItr; !ec && dirItr != endItr; dirItr.increment(ec)) {
+        std::string path = dirItr->path().u8string();
+        if (dirItr->is_directory(ec) && !dirItr->is_symlink(ec))
+            subdirectories.push_back(std::move(path));
+        else if (dirItr->is_regular_file(ec))
+            this->foundFile(path, dirItr->path().filename().u8string().c_str(), 0);
+    }
+}
+#endif
+
+void directoryScanner::scanThread() {
+    std::unique_lock<std::mutex> lock(mut);
+
+    while (true) {
+        // finished once there's nothing left to read and nobody reading could add any more
+        this->work.wait(lock, [this]() { return !this->directories.empty() || this->busy == 0; });
+        if (this->directories.empty())
+            return;
+
+        std::string directory = std::move(this->directories.back());
+        this->directories.pop_back();
+        this->busy++;
+
+        lock.unlock();
+        std::vector<std::string> subdirectories;
+        this->readDirectory(directory, subdirectories);
+        lock.lock();
+
+        this->busy--;
+        for (std::string& subdirectory : subdirectories)
+            this->directories.push_back(std::move(subdirectory));
+        this->work.notify_all();
+    }
+}
+
+void directoryScanner::scan(const std::vector<std::string>& roots, const unsigned int threads) {
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        this->directories = roots;
+        this->busy = 0;
+    }
+
+    std::vector<std::thread> scanners;
+    for (unsigned int i = 1; i < threads; i++)
+        scanners.push_back(std::thread(&directoryScanner::scanThread, this));
+    this->scanThread(); // the calling thread scans too
+
+    for (std::thread& t : scanners)
+        t.join();
+}
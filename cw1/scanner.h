@@ -0,0 +1,32 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/* Walks any number of root directories recursively, with several threads sharing one stack of directories still to be read
+ * Every image file found is handed to "onFile" straight away (from whichever scanner thread found it), so decoding can start long before a big tree has been fully listed
+ * On Linux directories are read with "getdents64" in large batches, and the entry type it returns means no file ever needs a "stat"
+ * The inode number comes free with each entry too, and is passed on for the reader to order by (it's 0 on other platforms)
+ */
+class directoryScanner
+{
+private:
+	std::function<void(const std::string&, uint64_t)> onFile;
+	std::vector<std::string> directories; // still to be read
+	size_t busy = 0; // threads reading a directory, which may push more onto "directories"
+	std::mutex mut;
+	std::condition_variable work;
+
+	void scanThread();
+	void readDirectory(const std::string& directory, std::vector<std::string>& subdirectories);
+	void foundFile(const std::string& path, const char* name, uint64_t inode);
+public:
+	directoryScanner(std::function<void(const std::string&, uint64_t)> _onFile) : onFile(_onFile) {}
+	~directoryScanner() = default;
+	void scan(const std::vector<std::string>& roots, unsigned int threads);
+};
+
+bool isImageFile(const std::string& path, const char* name);
@@ -0,0 +1,54 @@
+#include "skiplist.h"
+
+orderedSkipList::orderedSkipList() : random(1009) {
+    head.key = 0;
+    head.id = 0;
+    head.next.assign(MAX_LEVEL, nullptr);
+}
+
+orderedSkipList::~orderedSkipList() {
+    node* n = head.next[0];
+    while (n != nullptr) {
+        node* next = n->next[0];
+        delete n;
+        n = next;
+    }
+}
+
+int orderedSkipList::randomLevel() {
+    // each level has a quarter of the nodes of the one below, which keeps the list shallow without making searches much longer
+    int level = 1;
+    while (level < MAX_LEVEL && (random() & 3) == 0)
+        level++;
+    return level;
+}
+
+void orderedSkipList::insert(const double key, const size_t id) {
+    node* update[MAX_LEVEL];
+
+    node* n = &head;
+    for (int level = levels - 1; level >= 0; level--) {
+        while (n->next[level] != nullptr && before(n->next[level], key, id))
+            n = n->next[level];
+        update[level] = n;
+    }
+
+    int level = randomLevel();
+    for (int l = levels; l < level; l++)
+        update[l] = &head;
+    if (level > levels)
+        levels = level;
+
+    node* inserted = new node{ key, id, std::vector<node*>(level) };
+    for (int l = 0; l < level; l++) {
+        inserted->next[l] = update[l]->next[l];
+        update[l]->next[l] = inserted;
+    }
+
+    count++;
+}
+
+void orderedSkipList::appendInOrder(std::vector<size_t>& out) const {
+    for (const node* n = head.next[0]; n != nullptr; n = n->next[0])
+        out.push_back(n->id);
+}
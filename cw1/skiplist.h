@@ -0,0 +1,36 @@
+#pragma once
+#include <cstdint>
+#include <random>
+#include <vector>
+
+/* A skip list of image ids ordered by (key, id), where the key is the median hue
+ * Images arrive in whatever order their hues finish, so this keeps them sorted with an O(log n) insert each, rather than re-sorting everything at the end
+ * The id is part of the ordering so images with equal hues always come out in the same order
+ */
+class orderedSkipList
+{
+private:
+	static const int MAX_LEVEL = 32;
+
+	typedef struct node {
+		double key;
+		size_t id;
+		std::vector<node*> next;
+	} node;
+
+	node head;
+	int levels = 1;
+	size_t count = 0;
+	std::mt19937 random; // fixed seed, so the shape of the list (and so the timings) are repeatable
+
+	int randomLevel();
+	[[nodiscard]] static bool before(const node* n, double key, size_t id) { return n->key < key || (n->key == key && n->id < id); }
+public:
+	orderedSkipList();
+	~orderedSkipList();
+	orderedSkipList(const orderedSkipList&) = delete;
+	orderedSkipList& operator=(const orderedSkipList&) = delete;
+	void insert(double key, size_t id);
+	[[nodiscard]] size_t size() const { return count; }
+	void appendInOrder(std::vector<size_t>& out) const;
+};
@@ -0,0 +1,65 @@
+#include "check.h"
+#include "catalog.h"
+
+// a hue order that's all sorted, with "hues" ascending
+static catalogOrder makeHueOrder(const std::vector<double>& hues) {
+    catalogOrder order;
+    order.key = sortKey::hue;
+    order.values = hues;
+    order.sortedCount = hues.size();
+    for (size_t i = 0; i < hues.size(); i++) {
+        order.ids.push_back(i);
+        order.positions.push_back(i);
+    }
+    return order;
+}
+
+static bool sameRanges(const std::vector<positionRange>& ranges, const std::vector<positionRange>& expected) {
+    if (ranges.size() != expected.size())
+        return false;
+    for (size_t i = 0; i < ranges.size(); i++)
+        if (ranges[i].first != expected[i].first || ranges[i].last != expected[i].last)
+            return false;
+    return true;
+}
+
+void hueLookupTests() {
+    const catalogOrder order = makeHueOrder({ 5.0, 90.0, 90.0, 180.0, 350.0 });
+
+    // inclusive at both ends, the equal hues together
+    CHECK(sameRanges(hueRange(order, 90.0, 180.0), { { 1, 4 } }));
+    CHECK(sameRanges(hueRange(order, 100.0, 170.0), {}));
+
+    // round through 0, however it's written
+    CHECK(sameRanges(hueRange(order, 330.0, 30.0), { { 4, 5 }, { 0, 1 } }));
+    CHECK(sameRanges(hueRange(order, -30.0, 30.0), { { 4, 5 }, { 0, 1 } }));
+    CHECK(sameRanges(hueRange(order, 690.0, 750.0), { { 4, 5 }, { 0, 1 } }));
+    CHECK(sameRanges(hueRange(order, 355.0, 2.0), {}));
+    CHECK(sameRanges(hueRange(order, 0.0, 360.0), { { 0, 5 } }));
+    CHECK(sameRanges(hueRange(order, 100.0, 500.0), { { 0, 5 } }));
+
+    // the nearest going either way round; of equal hues, the one on the side "hue" is on
+    CHECK(nearestHue(order, 85.0) == 1);
+    CHECK(nearestHue(order, 100.0) == 2);
+    CHECK(nearestHue(order, 179.0) == 3);
+    CHECK(nearestHue(order, 359.0) == 0);
+    CHECK(nearestHue(order, 357.0) == 4);
+    CHECK(nearestHue(order, -10.0) == 4);
+    CHECK(nearestHue(order, 365.0) == 0);
+    CHECK(nearestHue(makeHueOrder({ 200.0 }), 10.0) == 0);
+
+    // only the sorted part counts, the rest have no hue yet
+    catalogOrder partial = makeHueOrder({ 5.0, 90.0, 90.0, 180.0, 350.0 });
+    partial.sortedCount = 2;
+    partial.values.resize(2);
+    CHECK(nearestHue(partial, 340.0) == 0);
+    CHECK(sameRanges(hueRange(partial, 0.0, 360.0), { { 0, 2 } }));
+
+    // nothing to find before the first hue is known
+    const catalogOrder empty = makeHueOrder({});
+    CHECK(nearestHue(empty, 0.0) == SIZE_MAX);
+    CHECK(nearestHue(empty, 359.0) == SIZE_MAX);
+    CHECK(hueRange(empty, 0.0, 360.0).empty());
+    CHECK(hueRange(empty, 330.0, 30.0).empty());
+    CHECK(hueRange(empty, 10.0, 20.0).empty());
+}
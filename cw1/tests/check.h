@@ -0,0 +1,12 @@
+#pragma once
+#include <iostream>
+
+// how many checks have failed so far, "main" exits with it so ctest sees the failure
+extern int failures;
+
+#define CHECK(condition) do { if (!(condition)) { failures++; std::cout << "(!) " << __FILE__ << ":" << __LINE__ << ": " << #condition << std::endl; } } while (false)
+
+void exifTests();
+void restartTests();
+void hueLookupTests();
+void sortTests();
@@ -0,0 +1,126 @@
+#include "check.h"
+#include <algorithm>
+#include <vector>
+#include "exif.h"
+
+static void putShort(std::vector<uint8_t>& out, const uint16_t value, const bool bigEndian) {
+    if (bigEndian)
+        out.insert(out.end(), { (uint8_t)(value >> 8), (uint8_t)value });
+    else
+        out.insert(out.end(), { (uint8_t)value, (uint8_t)(value >> 8) });
+}
+
+static void putLong(std::vector<uint8_t>& out, const uint32_t value, const bool bigEndian) {
+    putShort(out, (uint16_t)(bigEndian ? value >> 16 : value), bigEndian);
+    putShort(out, (uint16_t)(bigEndian ? value : value >> 16), bigEndian);
+}
+
+// one IFD entry with a single value, SHORTs are padded out to the 4 bytes a value takes
+static void putEntry(std::vector<uint8_t>& out, const uint16_t tag, const bool asShort, const uint32_t value, const bool bigEndian) {
+    putShort(out, tag, bigEndian);
+    putShort(out, asShort ? 3 : 4, bigEndian);
+    putLong(out, 1, bigEndian);
+    if (asShort) {
+        putShort(out, (uint16_t)value, bigEndian);
+        putShort(out, 0, bigEndian);
+    }
+    else
+        putLong(out, value, bigEndian);
+}
+
+static const std::vector<uint8_t> thumbnailBytes = { 0xFF, 0xD8, 0x01, 0x02, 0x03, 0xFF, 0xD9 };
+
+/* A TIFF structure like a camera's: an empty IFD0, then IFD1 describing the thumbnail that follows it
+ * "offset" and "length" override where IFD1 says the thumbnail is
+ */
+static std::vector<uint8_t> makeTiff(const bool bigEndian, const bool shortLength = false, const uint32_t offset = 44, const uint32_t length = 7) {
+    std::vector<uint8_t> tiff;
+    const char* header = bigEndian ? "MM\0*" : "II*\0";
+    tiff.insert(tiff.end(), header, header + 4);
+    putLong(tiff, 8, bigEndian);
+
+    putShort(tiff, 0, bigEndian); // IFD0, no entries
+    putLong(tiff, 14, bigEndian);
+
+    putShort(tiff, 2, bigEndian); // IFD1
+    putEntry(tiff, 0x0201, false, offset, bigEndian);
+    putEntry(tiff, 0x0202, shortLength, length, bigEndian);
+    putLong(tiff, 0, bigEndian);
+
+    tiff.insert(tiff.end(), thumbnailBytes.begin(), thumbnailBytes.end());
+    return tiff;
+}
+
+static void putSegment(std::vector<uint8_t>& jpeg, const uint8_t marker, const char* signature, const size_t signatureSize, const std::vector<uint8_t>& body) {
+    const size_t length = 2 + signatureSize + body.size();
+    jpeg.insert(jpeg.end(), { 0xFF, marker, (uint8_t)(length >> 8), (uint8_t)length });
+    jpeg.insert(jpeg.end(), signature, signature + signatureSize);
+    jpeg.insert(jpeg.end(), body.begin(), body.end());
+}
+
+// SOI, the APP1 holding "tiff", and the start of a scan, which is as far as the search ever reads
+static std::vector<uint8_t> makeJpeg(const std::vector<uint8_t>& tiff) {
+    std::vector<uint8_t> jpeg = { 0xFF, 0xD8 };
+    putSegment(jpeg, 0xE1, "Exif\0\0", 6, tiff);
+    jpeg.insert(jpeg.end(), { 0xFF, 0xDA, 0x00, 0x02, 0xFF, 0xD9 });
+    return jpeg;
+}
+
+static bool findsThumbnail(const std::vector<uint8_t>& jpeg, size_t* at = nullptr) {
+    const uint8_t* thumbnail = nullptr;
+    size_t thumbnailSize = 0;
+    if (!findExifThumbnail(jpeg.data(), jpeg.size(), &thumbnail, &thumbnailSize))
+        return false;
+    if (at != nullptr)
+        *at = thumbnail - jpeg.data();
+    return thumbnailSize == thumbnailBytes.size() && std::equal(thumbnailBytes.begin(), thumbnailBytes.end(), thumbnail);
+}
+
+void exifTests() {
+    // the TIFF starts after SOI (2), the APP1 marker and length (4) and "Exif\0\0" (6)
+    for (bool bigEndian : { false, true }) {
+        size_t at = 0;
+        CHECK(findsThumbnail(makeJpeg(makeTiff(bigEndian)), &at));
+        CHECK(at == 12 + 44);
+        CHECK(findsThumbnail(makeJpeg(makeTiff(bigEndian, true))));
+    }
+
+    // other APP segments before the EXIF one are skipped over, as are fill bytes
+    std::vector<uint8_t> jpeg = { 0xFF, 0xD8 };
+    putSegment(jpeg, 0xE0, "JFIF\0", 5, { 1, 1, 0, 0, 1, 0, 1, 0, 0 });
+    putSegment(jpeg, 0xE1, "http://ns.adobe.com/xap/1.0/\0", 29, { '<', '/', '>' });
+    jpeg.push_back(0xFF);
+    std::vector<uint8_t> withExif = makeJpeg(makeTiff(false));
+    jpeg.insert(jpeg.end(), withExif.begin() + 2, withExif.end());
+    CHECK(findsThumbnail(jpeg));
+
+    // no EXIF, or EXIF without a thumbnail, or one that isn't where IFD1 says
+    std::vector<uint8_t> plain = { 0xFF, 0xD8, 0xFF, 0xDA, 0x00, 0x02, 0xFF, 0xD9 };
+    CHECK(!findsThumbnail(plain));
+    std::vector<uint8_t> noIfd1 = makeTiff(false);
+    noIfd1[10] = 0;
+    CHECK(!findsThumbnail(makeJpeg(noIfd1)));
+    CHECK(!findsThumbnail(makeJpeg(makeTiff(false, false, 40))));
+    CHECK(!findsThumbnail(makeJpeg(makeTiff(true, false, 0xFFFFFFF0))));
+    CHECK(!findsThumbnail(makeJpeg(makeTiff(true, false, 44, 0xFFFFFFFF))));
+    std::vector<uint8_t> manyEntries = makeTiff(true);
+    manyEntries[14] = manyEntries[15] = 0xFF;
+    CHECK(!findsThumbnail(makeJpeg(manyEntries)));
+    std::vector<uint8_t> notTiff = makeTiff(false);
+    notTiff[0] = 'X';
+    CHECK(!findsThumbnail(makeJpeg(notTiff)));
+
+    // the file cut short anywhere, so the APP1 runs past its end
+    const std::vector<uint8_t> whole = makeJpeg(makeTiff(true));
+    for (size_t size = 0; size < 12 + 44 + thumbnailBytes.size(); size++) {
+        std::vector<uint8_t> cut(whole.begin(), whole.begin() + size);
+        CHECK(!findsThumbnail(cut));
+    }
+
+    // an APP1 that's whole but holds a truncated TIFF structure, so its offsets point past the segment
+    for (bool bigEndian : { false, true }) {
+        const std::vector<uint8_t> tiff = makeTiff(bigEndian);
+        for (size_t size = 0; size < tiff.size(); size++)
+            CHECK(!findsThumbnail(makeJpeg(std::vector<uint8_t>(tiff.begin(), tiff.begin() + size))));
+    }
+}
@@ -0,0 +1,24 @@
+#include "check.h"
+#include "bufferpool.h"
+
+// the decoders need stb_image, which the viewer builds into its own main.cpp
+#define STBI_MALLOC(size) pixelBuffers().allocate(size)
+#define STBI_REALLOC(block, size) pixelBuffers().reallocate(block, size)
+#define STBI_FREE(block) pixelBuffers().free(block)
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+int failures = 0;
+
+int main() {
+    exifTests();
+    restartTests();
+    hueLookupTests();
+    sortTests();
+
+    if (failures == 0)
+        std::cout << "all tests passed" << std::endl;
+    else
+        std::cout << failures << " check(s) failed" << std::endl;
+    return failures == 0 ? 0 : 1;
+}
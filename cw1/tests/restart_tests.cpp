@@ -0,0 +1,146 @@
+#include "check.h"
+#include "restart.h"
+
+#ifdef HAVE_LIBJPEG
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <jpeglib.h>
+
+#define TEST_WIDTH 200
+#define TEST_HEIGHT 333
+
+/* A gradient with some detail compressed with libjpeg, 4:2:0 so an MCU is 16 rows
+ * "restartRows" puts a restart marker after every that many MCU rows and "restartMcus" after every that many MCUs; both 0 means none
+ */
+static std::vector<uint8_t> compressTestImage(const int restartRows, const unsigned int restartMcus = 0, const bool progressive = false) {
+    std::vector<uint8_t> rgb((size_t)TEST_WIDTH * TEST_HEIGHT * 3);
+    for (int y = 0; y < TEST_HEIGHT; y++)
+        for (int x = 0; x < TEST_WIDTH; x++) {
+            uint8_t* pixel = &rgb[((size_t)y * TEST_WIDTH + x) * 3];
+            pixel[0] = (uint8_t)(x * 255 / TEST_WIDTH);
+            pixel[1] = (uint8_t)(y * 255 / TEST_HEIGHT);
+            pixel[2] = (uint8_t)((x ^ y) * 7);
+        }
+
+    jpeg_compress_struct compress;
+    jpeg_error_mgr errors;
+    compress.err = jpeg_std_error(&errors);
+    jpeg_create_compress(&compress);
+    unsigned char* buffer = nullptr;
+    unsigned long size = 0;
+    jpeg_mem_dest(&compress, &buffer, &size);
+
+    compress.image_width = TEST_WIDTH;
+    compress.image_height = TEST_HEIGHT;
+    compress.input_components = 3;
+    compress.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&compress);
+    jpeg_set_quality(&compress, 85, TRUE);
+    compress.restart_in_rows = restartRows;
+    compress.restart_interval = restartMcus;
+    if (progressive)
+        jpeg_simple_progression(&compress);
+
+    jpeg_start_compress(&compress, TRUE);
+    while (compress.next_scanline < compress.image_height) {
+        JSAMPROW row = &rgb[(size_t)compress.next_scanline * TEST_WIDTH * 3];
+        jpeg_write_scanlines(&compress, &row, 1);
+    }
+    jpeg_finish_compress(&compress);
+    jpeg_destroy_compress(&compress);
+
+    std::vector<uint8_t> jpeg(buffer, buffer + size);
+    free(buffer);
+    return jpeg;
+}
+
+// every piece's own rows, one after the other from the top, covering the whole image once
+static bool coversImage(const restartLayout& layout, const std::vector<restartPiece>& pieces) {
+    const unsigned int intervalRows = layout.mcuRowsPerInterval * layout.mcuHeight;
+    unsigned int row = 0;
+    for (const restartPiece& piece : pieces) {
+        if (piece.firstRow != row || piece.rows == 0 || piece.lastInterval > layout.intervals.size())
+            return false;
+        if (piece.firstRow - piece.skippedRows != piece.firstInterval * intervalRows)
+            return false;
+        row += piece.rows;
+    }
+    return row == layout.height;
+}
+
+static void splitTests(const std::vector<uint8_t>& jpeg, const unsigned int mcuRowsPerInterval) {
+    restartLayout layout;
+    CHECK(parseRestartIntervals(jpeg.data(), jpeg.size(), layout));
+    CHECK(layout.width == TEST_WIDTH && layout.height == TEST_HEIGHT);
+    CHECK(layout.mcuHeight == 16 && layout.mcuRowsPerInterval == mcuRowsPerInterval);
+    const size_t intervals = (TEST_HEIGHT + 16 * mcuRowsPerInterval - 1) / (16 * mcuRowsPerInterval);
+    CHECK(layout.intervals.size() == intervals);
+
+    // the interval either side is there for the upsampling context, but only inside the image
+    std::vector<restartPiece> pieces = splitRestartIntervals(layout, 4);
+    CHECK(pieces.size() == 4 && coversImage(layout, pieces));
+    CHECK(pieces.front().firstInterval == 0 && pieces.front().skippedRows == 0);
+    CHECK(pieces.back().lastInterval == intervals);
+    for (size_t p = 1; p < pieces.size(); p++)
+        CHECK(pieces[p].skippedRows == layout.mcuRowsPerInterval * layout.mcuHeight);
+
+    // never more pieces than intervals
+    pieces = splitRestartIntervals(layout, intervals * 3);
+    CHECK(pieces.size() == intervals && coversImage(layout, pieces));
+    CHECK(splitRestartIntervals(layout, 1).size() == 1);
+
+    std::string error;
+    decodedImage whole;
+    const jpegDecoder decoder;
+    CHECK(decoder.decode(jpeg.data(), jpeg.size(), whole, &error));
+    const size_t stride = (size_t)whole.width * whole.channels;
+
+    // each piece is a JPEG of its own, as tall as the intervals it holds (the last one stops at the bottom of the image), whose rows are the same as the whole image's
+    for (const restartPiece& piece : splitRestartIntervals(layout, 4)) {
+        std::vector<uint8_t> pieceJpeg = buildPiece(jpeg.data(), layout, piece);
+        const unsigned int expectedHeight = std::min(layout.height - (piece.firstRow - piece.skippedRows), (unsigned int)(piece.lastInterval - piece.firstInterval) * layout.mcuRowsPerInterval * 16);
+        CHECK((unsigned int)(pieceJpeg[layout.heightOffset] << 8 | pieceJpeg[layout.heightOffset + 1]) == expectedHeight);
+
+        decodedImage decoded;
+        CHECK(decoder.decode(pieceJpeg.data(), pieceJpeg.size(), decoded, &error));
+        CHECK(decoded.width == TEST_WIDTH && (unsigned int)decoded.height == expectedHeight);
+        if ((unsigned int)decoded.height == expectedHeight)
+            CHECK(memcmp(decoded.pixels.data() + piece.skippedRows * stride, whole.pixels.data() + piece.firstRow * stride, piece.rows * stride) == 0);
+    }
+
+    // and put back together on a pool, it's the same as decoding it on one thread
+    workerPool pool(3);
+    decodedImage parallel;
+    CHECK(decodeRestartIntervals(jpeg.data(), jpeg.size(), parallel, pool, &error));
+    CHECK(parallel.pixels == whole.pixels);
+}
+
+void restartTests() {
+    splitTests(compressTestImage(1), 1);
+    splitTests(compressTestImage(2), 2);
+
+    // restarts that don't fall at the start of an MCU row (200 pixels is 13 MCUs), none at all, or a progressive file can't be split
+    restartLayout layout;
+    std::vector<uint8_t> jpeg = compressTestImage(0, 5);
+    CHECK(!parseRestartIntervals(jpeg.data(), jpeg.size(), layout));
+    jpeg = compressTestImage(0);
+    layout = restartLayout();
+    CHECK(!parseRestartIntervals(jpeg.data(), jpeg.size(), layout));
+    jpeg = compressTestImage(1, 0, true);
+    layout = restartLayout();
+    CHECK(!parseRestartIntervals(jpeg.data(), jpeg.size(), layout));
+
+    // a file cut short is missing intervals, wherever it's cut
+    jpeg = compressTestImage(1);
+    for (size_t size = 0; size < jpeg.size() - 1; size += 97) {
+        layout = restartLayout();
+        CHECK(!parseRestartIntervals(jpeg.data(), size, layout));
+    }
+}
+#else
+void restartTests() {
+    std::cout << "restart interval tests skipped, built without libjpeg" << std::endl;
+}
+#endif
@@ -0,0 +1,106 @@
+#include "check.h"
+#include <algorithm>
+#include <random>
+#include "catalog.h"
+#include "radixsort.h"
+
+// what "radixSort" should give: the keys ascending, and the ids of equal keys in the order they came in
+static bool sortsStably(const std::vector<uint64_t>& keys, const unsigned int threads) {
+    std::vector<std::pair<uint64_t, uint32_t>> expected;
+    for (size_t i = 0; i < keys.size(); i++)
+        expected.push_back({ keys[i], (uint32_t)i });
+    std::stable_sort(expected.begin(), expected.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    std::vector<uint64_t> sorted = keys;
+    std::vector<uint32_t> ids(keys.size());
+    for (size_t i = 0; i < ids.size(); i++)
+        ids[i] = (uint32_t)i;
+    radixSort(sorted, ids, threads);
+
+    for (size_t i = 0; i < keys.size(); i++)
+        if (sorted[i] != expected[i].first || ids[i] != expected[i].second)
+            return false;
+    return true;
+}
+
+static imageFeatures makeFeatures(const uint8_t saturation, const uint8_t value) {
+    imageFeatures features = {};
+    features.medianSaturation = saturation;
+    features.medianValue = value;
+    features.known = 1;
+    return features;
+}
+
+static catalogEntry makeEntry(const double hue, const imageFeatures& features, const uint32_t pathHash) {
+    catalogEntry entry = {};
+    entry.medianHue = hue;
+    entry.hueKnown = true;
+    entry.features = features;
+    entry.pathHash = pathHash;
+    return entry;
+}
+
+void sortTests() {
+    std::mt19937_64 random(10108);
+
+    // a few distinct values spread over every digit, so there are plenty of ties, on one thread and split over several
+    std::vector<uint64_t> keys(RADIX_PARALLEL_KEYS * 3);
+    std::vector<uint64_t> values(40);
+    for (uint64_t& value : values)
+        value = random();
+    for (uint64_t& key : keys)
+        key = values[random() % values.size()];
+    for (unsigned int threads : { 1u, 2u, 5u })
+        CHECK(sortsStably(keys, threads));
+
+    // small enough to stay on the calling thread whatever it's given; and keys that differ only in the top or bottom digit
+    keys.resize(1000);
+    CHECK(sortsStably(keys, 8));
+    for (size_t i = 0; i < keys.size(); i++)
+        keys[i] = (uint64_t)(random() % 3) << 62 | (random() % 2);
+    CHECK(sortsStably(keys, 1));
+
+    // every digit the same, so every pass is skipped and nothing moves
+    CHECK(sortsStably(std::vector<uint64_t>(5000, 0x123456789ABCDEFull), 4));
+    CHECK(sortsStably({}, 4));
+
+    // doubles' bits sort the same as the doubles, negative ones too
+    const std::vector<double> doubles = { 3.5, -1.0, 0.0, -0.5, 360.0, -1e9, 1e-9, 42.0 };
+    std::vector<uint64_t> bits;
+    for (double value : doubles)
+        bits.push_back(orderedBits(value));
+    std::vector<uint32_t> order(doubles.size());
+    for (size_t i = 0; i < order.size(); i++)
+        order[i] = (uint32_t)i;
+    radixSort(bits, order, 1);
+    for (size_t i = 0; i < order.size(); i++) {
+        CHECK(fromOrderedBits(bits[i]) == doubles[order[i]]);
+        if (i > 0)
+            CHECK(doubles[order[i - 1]] < doubles[order[i]]);
+    }
+
+    // the colour order: coloured images by hue, then saturation, then value, and every neutral one after them from dark to light
+    const std::vector<catalogEntry> entries = {
+        makeEntry(350.0, makeFeatures(200, 100), 1), // 0: red-ish, late on the wheel
+        makeEntry(200.0, makeFeatures(10, 250), 2), // 1: neutral, light
+        makeEntry(10.0, makeFeatures(200, 100), 3), // 2: red
+        makeEntry(120.0, makeFeatures(100, 100), 4), // 3: green
+        makeEntry(0.0, makeFeatures(5, 20), 5), // 4: neutral, dark
+        makeEntry(120.0, makeFeatures(150, 100), 6), // 5: green, more saturated
+        makeEntry(120.0, makeFeatures(150, 100), 0), // 6: the same again, the path hash breaks the tie
+        makeEntry(120.0, imageFeatures(), 7), // 7: no features yet, so placed by its hue alone
+    };
+    std::vector<uint64_t> colourKeys;
+    for (const catalogEntry& entry : entries)
+        colourKeys.push_back(colourKey(entry));
+    std::vector<uint32_t> ids(entries.size());
+    for (size_t i = 0; i < ids.size(); i++)
+        ids[i] = (uint32_t)i;
+    radixSort(colourKeys, ids, 1);
+    CHECK((ids == std::vector<uint32_t>{ 2, 7, 3, 6, 5, 0, 4, 1 }));
+
+    // the neutral bit is the top one, so even the reddest neutral image goes after the last hue on the wheel
+    CHECK(colourKey(entries[4]) >> 63 == 1);
+    CHECK(colourKey(entries[0]) >> 63 == 0);
+    CHECK(colourKey(makeEntry(359.99, makeFeatures(255, 255), 0x7fffffff)) < colourKey(makeEntry(0.0, makeFeatures(0, 0), 0)));
+}
@@ -0,0 +1,366 @@
+#include "thumbnails.h"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+static const char STORE_MAGIC[4] = { 'I', 'F', 'T', 'S' };
+static const uint32_t STORE_VERSION = 3; // 2 added the features and 3 the perceptual hue and lightness, an older store is rebuilt
+
+fileKey makeFileKey(const std::string& path) {
+    std::error_code ec;
+    fileKey key = { path, 0, 0 };
+
+    uintmax_t size = fs::file_size(path, ec);
+    if (ec)
+        return key;
+    auto mtime = fs::last_write_time(path, ec);
+    if (ec)
+        return key;
+
+    key.size = size;
+    key.mtime = (int64_t)mtime.time_since_epoch().count();
+    return key;
+}
+
+bool thumbnailStore::map() {
+    this->mapping.reset();
+    this->base = nullptr;
+    this->mappedSize = 0;
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(this->path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE fileMapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (fileMapping == NULL)
+        return false;
+
+    void* view = MapViewOfFile(fileMapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(fileMapping); // the view keeps the mapping alive on its own
+    if (view == NULL)
+        return false;
+
+    this->mapping = std::shared_ptr<const void>(view, [](const void* p) { UnmapViewOfFile(p); });
+    this->mappedSize = (size_t)fileSize.QuadPart;
+#else
+    int fd = ::open(this->path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+
+    size_t size = (size_t)st.st_size;
+    void* view = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); // the mapping holds its own reference to the file
+    if (view == MAP_FAILED)
+        return false;
+
+    this->mapping = std::shared_ptr<const void>(view, [size](const void* p) { munmap(const_cast<void*>(p), size); });
+    this->mappedSize = size;
+#endif
+
+    this->base = static_cast<const uint8_t*>(this->mapping.get());
+    return true;
+}
+
+bool thumbnailStore::open() {
+    std::lock_guard<std::mutex> lock(mut);
+
+    this->index.clear();
+    if (!this->map())
+        return false;
+
+    const storeHeader* header = reinterpret_cast<const storeHeader*>(this->base);
+    if (this->mappedSize < sizeof(storeHeader) || memcmp(header->magic, STORE_MAGIC, sizeof(STORE_MAGIC)) != 0 || header->version != STORE_VERSION
+        || header->entryCount > (this->mappedSize - sizeof(storeHeader)) / sizeof(indexRecord)) {
+        std::cout << "(!) thumbnail store \"" << this->path << "\" is not valid, it will be rebuilt" << std::endl;
+        this->mapping.reset();
+        this->base = nullptr;
+        return false;
+    }
+
+    // every offset is checked against the size of the file, so a truncated store loses entries rather than crashing the viewer
+    const indexRecord* records = reinterpret_cast<const indexRecord*>(this->base + sizeof(storeHeader));
+    for (uint64_t i = 0; i < header->entryCount; i++) {
+        const indexRecord& r = records[i];
+        uint64_t thumbnailBytes = (uint64_t)r.thumbnailWidth * r.thumbnailHeight * 4;
+        uint64_t previewBytes = (uint64_t)r.previewWidth * r.previewHeight * 4;
+
+        if (r.pathOffset + r.pathLength > this->mappedSize || r.thumbnailOffset + thumbnailBytes > this->mappedSize || r.previewOffset + previewBytes > this->mappedSize)
+            continue;
+
+        this->index[std::string(reinterpret_cast<const char*>(this->base + r.pathOffset), r.pathLength)] = &r;
+    }
+
+    return true;
+}
+
+thumbnailStore::~thumbnailStore() {
+    this->removeSpill();
+}
+
+// an unsaved entry is only of use for the same version of the file, like a saved one
+const thumbnailStore::pendingEntry* thumbnailStore::findPending(const fileKey& key) const {
+    auto itr = this->pending.find(key.path);
+    if (itr == this->pending.end() || itr->second.key.size != key.size || itr->second.key.mtime != key.mtime)
+        return nullptr;
+    return &itr->second;
+}
+
+bool thumbnailStore::readSpill(const uint64_t offset, const size_t bytes, uint8_t* into) const {
+    this->spill.seekg((std::streamoff)offset);
+    this->spill.read(reinterpret_cast<char*>(into), (std::streamsize)bytes);
+    if (this->spill.fail()) {
+        this->spill.clear();
+        return false;
+    }
+    return true;
+}
+
+// a pending bitmap is read back into a buffer of its own, which the returned "mapping" keeps alive in place of the store's
+bool thumbnailStore::lookupPending(const uint64_t offset, const unsigned int width, const unsigned int height, storedBitmap* out) const {
+    if (width == 0 || height == 0)
+        return false;
+
+    std::shared_ptr<std::vector<uint8_t>> pixels = std::make_shared<std::vector<uint8_t>>((size_t)width * height * 4);
+    if (!this->readSpill(offset, pixels->size(), pixels->data()))
+        return false;
+
+    *out = { pixels, pixels->data(), width, height };
+    return true;
+}
+
+void thumbnailStore::removeSpill() {
+    if (this->spill.is_open())
+        this->spill.close();
+    std::error_code ec;
+    fs::remove(this->path + ".pending", ec);
+}
+
+const thumbnailStore::indexRecord* thumbnailStore::find(const fileKey& key) const {
+    auto itr = this->index.find(key.path);
+    if (itr == this->index.end() || itr->second->fileSize != key.size || itr->second->mtime != key.mtime)
+        return nullptr;
+    return itr->second;
+}
+
+bool thumbnailStore::lookupHue(const fileKey& key, double* medianHue, imageFeatures* features) const {
+    std::lock_guard<std::mutex> lock(mut);
+
+    const indexRecord* r = this->find(key);
+    if (r == nullptr)
+        return false;
+
+    *medianHue = r->medianHue;
+    memcpy(features, &r->features, sizeof(imageFeatures)); // the record is packed, so the features may not be aligned
+    return true;
+}
+
+bool thumbnailStore::lookupThumbnail(const fileKey& key, storedBitmap* out) const {
+    std::lock_guard<std::mutex> lock(mut);
+
+    // an entry added this run replaces whatever the saved store had for the file
+    if (const pendingEntry* p = this->findPending(key))
+        return this->lookupPending(p->thumbnailOffset, p->thumbnailWidth, p->thumbnailHeight, out);
+
+    const indexRecord* r = this->find(key);
+    if (r == nullptr || r->thumbnailWidth == 0 || r->thumbnailHeight == 0)
+        return false;
+
+    *out = { this->mapping, this->base + r->thumbnailOffset, r->thumbnailWidth, r->thumbnailHeight };
+    return true;
+}
+
+bool thumbnailStore::lookupPreview(const fileKey& key, storedBitmap* out) const {
+    std::lock_guard<std::mutex> lock(mut);
+
+    if (const pendingEntry* p = this->findPending(key))
+        return this->lookupPending(p->previewOffset, p->previewWidth, p->previewHeight, out);
+
+    const indexRecord* r = this->find(key);
+    if (r == nullptr || r->previewWidth == 0 || r->previewHeight == 0)
+        return false;
+
+    *out = { this->mapping, this->base + r->previewOffset, r->previewWidth, r->previewHeight };
+    return true;
+}
+
+size_t thumbnailStore::size() const {
+    std::lock_guard<std::mutex> lock(mut);
+    return this->index.size();
+}
+
+/* The pixels are appended to the spill file now, and only the record is kept in memory until "save"
+ * False if they couldn't be written, in which case the caller still has the only copy of them
+ */
+bool thumbnailStore::add(const fileKey& key, const double medianHue, const imageFeatures& features, const bitmap& thumbnail, const bitmap& preview) {
+    std::lock_guard<std::mutex> lock(mut);
+
+    if (!this->spill.is_open()) {
+        this->spill.open(this->path + ".pending", std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!this->spill.is_open()) {
+            std::cout << "(!) failed to create the thumbnail store's spill file" << std::endl;
+            return false;
+        }
+    }
+
+    this->spill.seekp(0, std::ios::end);
+    const uint64_t thumbnailOffset = (uint64_t)this->spill.tellp();
+    const uint64_t previewOffset = thumbnailOffset + thumbnail.pixels.size();
+    this->spill.write(reinterpret_cast<const char*>(thumbnail.pixels.data()), (std::streamsize)thumbnail.pixels.size());
+    this->spill.write(reinterpret_cast<const char*>(preview.pixels.data()), (std::streamsize)preview.pixels.size());
+    this->spill.flush();
+    if (this->spill.fail()) {
+        this->spill.clear();
+        return false;
+    }
+
+    this->pending[key.path] = { key, medianHue, features, thumbnailOffset, thumbnail.width, thumbnail.height, previewOffset, preview.width, preview.height };
+    return true;
+}
+
+bool thumbnailStore::save() {
+    std::unique_lock<std::mutex> lock(mut);
+
+    if (this->pending.empty())
+        return true;
+
+    /* Each entry to be written is either a new one from "add", or an existing one that's still valid
+     * Existing entries are copied straight out of the current mapping, so nothing needs to be decoded again; new ones are copied out of the spill file a bitmap at a time
+     * Entries whose source file has changed or gone are dropped here, otherwise the store would only ever grow
+     */
+    typedef struct {
+        fileKey key;
+        double medianHue;
+        imageFeatures features;
+        const uint8_t* thumbnailPixels; // null for a pending entry, whose pixels are at these offsets in the spill file
+        unsigned int thumbnailWidth, thumbnailHeight;
+        const uint8_t* previewPixels;
+        unsigned int previewWidth, previewHeight;
+        uint64_t thumbnailSpill, previewSpill;
+    } outputEntry;
+
+    std::vector<outputEntry> entries;
+    entries.reserve(this->index.size() + this->pending.size());
+
+    for (auto& p : this->pending) {
+        const pendingEntry& e = p.second;
+        entries.push_back({ e.key, e.medianHue, e.features, nullptr, e.thumbnailWidth, e.thumbnailHeight, nullptr, e.previewWidth, e.previewHeight, e.thumbnailOffset, e.previewOffset });
+    }
+    for (auto& i : this->index) {
+        if (this->pending.count(i.first))
+            continue;
+
+        fileKey key = makeFileKey(i.first);
+        const indexRecord* r = this->find(key);
+        if (r == nullptr)
+            continue;
+
+        imageFeatures features;
+        memcpy(&features, &r->features, sizeof(imageFeatures));
+        entries.push_back({ key, r->medianHue, features, this->base + r->thumbnailOffset, r->thumbnailWidth, r->thumbnailHeight, this->base + r->previewOffset, r->previewWidth, r->previewHeight, 0, 0 });
+    }
+
+    // lay the file out: header, index, strings, pixels
+    std::vector<indexRecord> records(entries.size());
+    uint64_t offset = sizeof(storeHeader) + sizeof(indexRecord) * entries.size();
+    for (size_t i = 0; i < entries.size(); i++) {
+        records[i].pathOffset = offset;
+        records[i].pathLength = (uint32_t)entries[i].key.path.size();
+        records[i].fileSize = entries[i].key.size;
+        records[i].mtime = entries[i].key.mtime;
+        records[i].medianHue = entries[i].medianHue;
+        records[i].features = entries[i].features;
+        offset += records[i].pathLength;
+    }
+    for (size_t i = 0; i < entries.size(); i++) {
+        records[i].thumbnailOffset = offset;
+        records[i].thumbnailWidth = (uint16_t)entries[i].thumbnailWidth;
+        records[i].thumbnailHeight = (uint16_t)entries[i].thumbnailHeight;
+        offset += (uint64_t)entries[i].thumbnailWidth * entries[i].thumbnailHeight * 4;
+
+        records[i].previewOffset = offset;
+        records[i].previewWidth = (uint16_t)entries[i].previewWidth;
+        records[i].previewHeight = (uint16_t)entries[i].previewHeight;
+        offset += (uint64_t)entries[i].previewWidth * entries[i].previewHeight * 4;
+    }
+
+    // written to a temporary file then renamed over the old one, so a crash half way through never leaves a corrupt store
+    std::string temporaryPath = this->path + ".tmp";
+    std::ofstream out(temporaryPath, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+        std::cout << "(!) failed to open/create thumbnail store" << std::endl;
+        return false;
+    }
+
+    storeHeader header;
+    memcpy(header.magic, STORE_MAGIC, sizeof(STORE_MAGIC));
+    header.version = STORE_VERSION;
+    header.entryCount = entries.size();
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(records.data()), sizeof(indexRecord) * records.size());
+    for (auto& e : entries)
+        out.write(e.key.path.data(), e.key.path.size());
+    std::vector<uint8_t> spilled;
+    bool readSpilled = true;
+    auto writePixels = [&](const uint8_t* pixels, uint64_t spillOffset, size_t bytes) {
+        if (pixels == nullptr) {
+            spilled.resize(bytes);
+            readSpilled = readSpilled && this->readSpill(spillOffset, bytes, spilled.data());
+            pixels = spilled.data();
+        }
+        out.write(reinterpret_cast<const char*>(pixels), (std::streamsize)bytes);
+    };
+    for (auto& e : entries) {
+        writePixels(e.thumbnailPixels, e.thumbnailSpill, (size_t)e.thumbnailWidth * e.thumbnailHeight * 4);
+        writePixels(e.previewPixels, e.previewSpill, (size_t)e.previewWidth * e.previewHeight * 4);
+    }
+    out.close();
+
+    if (out.fail() || !readSpilled) {
+        std::cout << "(!) failed to write thumbnail store" << std::endl;
+        return false;
+    }
+
+    // "entries" points into the old mapping and the spill file, so both are only let go of once the new file is complete
+    entries.clear();
+    this->pending.clear();
+    this->removeSpill();
+    this->index.clear();
+    this->mapping.reset();
+    this->base = nullptr;
+
+    std::error_code ec;
+    fs::rename(temporaryPath, this->path, ec);
+    if (ec) {
+        std::cout << "(!) failed to replace thumbnail store: " << ec.message() << std::endl;
+        return false;
+    }
+
+    lock.unlock();
+    return this->open();
+}
@@ -0,0 +1,99 @@
+#pragma once
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "image.h"
+
+// identifies a source file; an entry in the store is only used while all three of these still match the file on disk
+typedef struct {
+	std::string path;
+	uint64_t size;
+	int64_t mtime;
+} fileKey;
+
+// a bitmap that lives inside the memory-mapped store, "mapping" keeps the pages valid for as long as the caller holds onto it
+typedef struct {
+	std::shared_ptr<const void> mapping;
+	const uint8_t* pixels; // RGBA
+	unsigned int width;
+	unsigned int height;
+} storedBitmap;
+
+fileKey makeFileKey(const std::string& path);
+
+/* One packed file holding the thumbnail, preview, median hue and features of every image we've processed before
+ * The file is memory-mapped, so on a warm start the viewer can upload straight from the page cache without decoding any JPEGs
+ * Layout: a header, a fixed-size index (one record per image), the path strings, then the RGBA pixel blobs; everything is found via offsets in the index
+ * Images added while loading have their pixels written straight to a spill file beside it (".pending"), so a preview doesn't sit in memory until the store is saved
+ */
+class thumbnailStore
+{
+private:
+	#pragma pack(push, 1)
+	typedef struct {
+		char magic[4];
+		uint32_t version;
+		uint64_t entryCount;
+	} storeHeader;
+
+	typedef struct {
+		uint64_t pathOffset;
+		uint32_t pathLength;
+		uint64_t fileSize;
+		int64_t mtime;
+		double medianHue;
+		imageFeatures features;
+		uint64_t thumbnailOffset;
+		uint16_t thumbnailWidth;
+		uint16_t thumbnailHeight;
+		uint64_t previewOffset;
+		uint16_t previewWidth;
+		uint16_t previewHeight;
+	} indexRecord;
+	#pragma pack(pop)
+
+	// an entry added since the last "save", its pixels are in the spill file rather than in memory
+	typedef struct {
+		fileKey key;
+		double medianHue;
+		imageFeatures features;
+		uint64_t thumbnailOffset;
+		unsigned int thumbnailWidth;
+		unsigned int thumbnailHeight;
+		uint64_t previewOffset;
+		unsigned int previewWidth;
+		unsigned int previewHeight;
+	} pendingEntry;
+
+	std::string path;
+	std::shared_ptr<const void> mapping; // the mapped file; shared so bitmaps handed out survive a "save" remapping the store
+	const uint8_t* base = nullptr;
+	size_t mappedSize = 0;
+	std::unordered_map<std::string, const indexRecord*> index;
+	std::unordered_map<std::string, pendingEntry> pending;
+	mutable std::fstream spill; // the pending entries' pixels, appended as they're added and copied into the store by "save"
+	mutable std::mutex mut;
+
+	bool map();
+	[[nodiscard]] const indexRecord* find(const fileKey& key) const;
+	[[nodiscard]] const pendingEntry* findPending(const fileKey& key) const;
+	bool readSpill(uint64_t offset, size_t bytes, uint8_t* into) const;
+	bool lookupPending(uint64_t offset, unsigned int width, unsigned int height, storedBitmap* out) const;
+	void removeSpill();
+public:
+	thumbnailStore(std::string _path) : path(_path) {}
+	~thumbnailStore();
+	thumbnailStore(const thumbnailStore&) = delete;
+	thumbnailStore& operator=(const thumbnailStore&) = delete;
+	bool open();
+	[[nodiscard]] bool lookupHue(const fileKey& key, double* medianHue, imageFeatures* features) const;
+	[[nodiscard]] bool lookupThumbnail(const fileKey& key, storedBitmap* out) const;
+	[[nodiscard]] bool lookupPreview(const fileKey& key, storedBitmap* out) const;
+	[[nodiscard]] size_t size() const;
+	bool add(const fileKey& key, double medianHue, const imageFeatures& features, const bitmap& thumbnail, const bitmap& preview);
+	bool save();
+};
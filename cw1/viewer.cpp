@@ -0,0 +1,530 @@
+#include "viewer.h"
+#include <cmath>
+#include <thread>
+
+// "M_PI" isn't standard C++, MSVC only has it with "_USE_MATH_DEFINES"
+static const double RADIANS_PER_DEGREE = 3.14159265358979323846 / 180.0;
+
+sf::Vector2f ScaleFromDimensions(const sf::Vector2u& textureSize, int screenWidth, int screenHeight)
+{
+    float scaleX = screenWidth / float(textureSize.x);
+    float scaleY = screenHeight / float(textureSize.y);
+    float scale = std::min(scaleX, scaleY);
+    return { scale, scale };
+}
+
+// uploads a mapped bitmap from the store, this is just a copy from the page cache to the GPU so it's far quicker than decoding the file
+static bool loadStoredTexture(const storedBitmap& stored, sf::Texture& texture) {
+    if (!texture.create(stored.width, stored.height))
+        return false;
+    texture.update(stored.pixels);
+    return true;
+}
+
+static bool loadBitmapTexture(const std::shared_ptr<const bitmap>& bmp, sf::Texture& texture) {
+    if (bmp == nullptr || bmp->pixels.empty() || !texture.create(bmp->width, bmp->height))
+        return false;
+    texture.update(bmp->pixels.data());
+    return true;
+}
+
+// the display-sized preview is tried first (from the store, then the one made while loading), and only if neither exists do we decode the original
+static bool loadDisplayTexture(const catalogEntry& entry, const thumbnailStore& store, sf::Texture& texture) {
+    storedBitmap stored;
+    if (store.lookupPreview(makeFileKey(entry.path), &stored) && loadStoredTexture(stored, texture))
+        return true;
+    if (loadBitmapTexture(entry.preview, texture))
+        return true;
+    return texture.loadFromFile(entry.path);
+}
+
+static bool loadThumbnailTexture(const catalogEntry& entry, const thumbnailStore& store, sf::Texture& texture) {
+    storedBitmap stored;
+    if (store.lookupThumbnail(makeFileKey(entry.path), &stored) && loadStoredTexture(stored, texture))
+        return true;
+    return loadBitmapTexture(entry.thumbnail, texture);
+}
+
+// fully saturated and bright, for drawing the colour wheel
+static sf::Color hueColour(const double hue) {
+    double sector = fmod(hue, 360.0) / 60.0;
+    double rising = sector - floor(sector), falling = 1.0 - rising;
+    double channels[6][3] = { { 1, rising, 0 }, { falling, 1, 0 }, { 0, 1, rising }, { 0, falling, 1 }, { rising, 0, 1 }, { 1, 0, falling } };
+    double* c = channels[(int)sector % 6];
+    return sf::Color((sf::Uint8)(c[0] * 255), (sf::Uint8)(c[1] * 255), (sf::Uint8)(c[2] * 255));
+}
+
+viewer::viewer(std::shared_ptr<catalog> _cat, std::shared_ptr<thumbnailStore> _store, std::shared_ptr<memoryBudget> _budget, const std::string& placeholderPath) : cat(_cat), store(_store), budget(_budget), gridTextures(GRID_COLUMNS * GRID_ROWS) {
+    this->order = this->cat->orderBy(this->key, &this->snapshot);
+
+    // the placeholder is loaded once up front; if the file is missing a plain grey square is used instead, so there is always something to show straight away
+    if (!this->placeholder.loadFromFile(placeholderPath)) {
+        sf::Image grey;
+        grey.create(WIDTH, HEIGHT, sf::Color(48, 48, 48));
+        this->placeholder.loadFromImage(grey);
+    }
+
+    this->gridSelection.setSize(sf::Vector2f(THUMBNAIL_WIDTH - 2.f, THUMBNAIL_HEIGHT - 2.f));
+    this->gridSelection.setFillColor(sf::Color::Transparent);
+    this->gridSelection.setOutlineColor(sf::Color::White);
+    this->gridSelection.setOutlineThickness(2.f);
+
+    this->buildWheel();
+
+    // Load an image to begin with
+    this->showImage();
+}
+
+viewer::~viewer() {
+    this->cancelPyramid();
+    {
+        std::lock_guard<std::mutex> lock(pyramidMutex);
+        this->pyramidStopping = true;
+    }
+    this->pyramidWanted.notify_all();
+    if (this->pyramidWorker.joinable())
+        this->pyramidWorker.join();
+}
+
+// a ring of hues, 0 degrees pointing right and going anticlockwise, the same as "handleClick" reads it back
+void viewer::buildWheel() {
+    const int segments = 72;
+    const sf::Vector2f centre = this->wheelCentre();
+    this->wheel = sf::VertexArray(sf::TriangleStrip, (segments + 1) * 2);
+    for (int i = 0; i <= segments; i++) {
+        double hue = 360.0 * i / segments;
+        float angle = (float)(hue * RADIANS_PER_DEGREE);
+        sf::Vector2f direction(std::cos(angle), -std::sin(angle));
+        this->wheel[i * 2] = sf::Vertex(centre + direction * (float)WHEEL_OUTER, hueColour(hue));
+        this->wheel[i * 2 + 1] = sf::Vertex(centre + direction * (float)WHEEL_INNER, hueColour(hue));
+    }
+
+    const float markerRadius = (WHEEL_OUTER - WHEEL_INNER) / 2.f;
+    this->wheelMarker.setRadius(markerRadius);
+    this->wheelMarker.setOrigin(markerRadius, markerRadius);
+    this->wheelMarker.setFillColor(sf::Color::Transparent);
+    this->wheelMarker.setOutlineColor(sf::Color::White);
+    this->wheelMarker.setOutlineThickness(2.f);
+}
+
+// the title shows the file name and where it is in the current order, which grows while images are still being processed
+void viewer::updateTitle() {
+    if (this->shownId == SIZE_MAX) {
+        this->title = "Image Fever";
+        return;
+    }
+
+    size_t total = this->snapshot->entries.size();
+    std::string title = this->entryAt(this->imageIndex).path;
+    if ((size_t)this->imageIndex < this->order->sortedCount)
+        title += "  [" + std::to_string(this->imageIndex + 1) + " of " + std::to_string(this->order->sortedCount) + " sorted by " + sortKeyName(this->key);
+    else
+        title += "  [not sorted by " + sortKeyName(this->key) + " yet";
+    if (this->order->sortedCount < total || !this->snapshot->complete)
+        title += ", " + std::to_string(total - this->order->sortedCount) + " still processing";
+    this->title = title + "]";
+}
+
+// loads the image at "imageIndex", or the placeholder if nothing has been loaded yet
+void viewer::showImage() {
+    this->resetZoom();
+
+    if (this->imageIndex < (int)this->order->ids.size()) {
+        const catalogEntry& entry = this->entryAt(this->imageIndex);
+        this->shownId = entry.id;
+        // set it as the window title 
+        this->updateTitle();
+        // ... and load the appropriate texture, and put it in the sprite
+        if (loadDisplayTexture(entry, *this->store, this->texture)) {
+            this->sprite = sf::Sprite(this->texture);
+            // Make sure the texture fits the screen
+            this->sprite.setScale(ScaleFromDimensions(this->texture.getSize(), WIDTH, HEIGHT));
+            return;
+        }
+    }
+    else {
+        this->shownId = SIZE_MAX;
+        this->updateTitle();
+    }
+
+    this->sprite = sf::Sprite(this->placeholder);
+    this->sprite.setScale(ScaleFromDimensions(this->placeholder.getSize(), WIDTH, HEIGHT));
+}
+
+void viewer::buildGridPage() {
+    const int gridPageSize = GRID_COLUMNS * GRID_ROWS;
+    const int size = (int)this->order->ids.size();
+
+    this->gridPage = this->imageIndex / gridPageSize;
+    this->gridSprites.clear();
+
+    for (int i = 0; i < gridPageSize && this->gridPage * gridPageSize + i < size; i++) {
+        sf::Sprite thumbnail;
+        if (loadThumbnailTexture(this->entryAt(this->gridPage * gridPageSize + i), *this->store, this->gridTextures[i])) {
+            thumbnail.setTexture(this->gridTextures[i], true);
+            // centre the thumbnail in its cell, they're already scaled to fit so only the offset is needed
+            sf::Vector2u thumbnailSize = this->gridTextures[i].getSize();
+            thumbnail.setPosition((i % GRID_COLUMNS) * THUMBNAIL_WIDTH + (THUMBNAIL_WIDTH - thumbnailSize.x) / 2.f, (i / GRID_COLUMNS) * THUMBNAIL_HEIGHT + (THUMBNAIL_HEIGHT - thumbnailSize.y) / 2.f);
+        }
+        this->gridSprites.push_back(thumbnail);
+    }
+}
+
+// picks up the latest version of the catalog; this is an atomic load, so the worker threads are never waited on
+bool viewer::refresh() {
+    // a pyramid that finished building is only used if its image is still the one being shown
+    if (this->pyramidLoad != nullptr && this->pyramidLoad->done) {
+        if (this->pyramidLoad->id == this->shownId && this->pyramidLoad->result != nullptr) {
+            this->pyramid = this->pyramidLoad->result;
+            this->redraw = true;
+        }
+        this->pyramidLoad = nullptr;
+    }
+
+    // for a key other than hue the order is whichever the catalog last finished sorting, which can change without a new snapshot (the final one is sorted after the last publish)
+    std::shared_ptr<const catalogSnapshot> latest;
+    std::shared_ptr<const catalogOrder> latestOrder = this->cat->orderBy(this->key, &latest);
+    if (latest->version == this->snapshot->version && latestOrder == this->order)
+        return this->redraw;
+
+    // the grid's selection moves without opening anything, so it's followed by id rather than by the image last shown
+    const size_t selectedId = this->imageIndex < (int)this->order->ids.size() ? this->order->ids[this->imageIndex] : SIZE_MAX;
+
+    this->snapshot = latest;
+    this->order = latestOrder;
+    this->gridPage = -1;
+    this->redraw = true;
+
+    if (this->shownId == SIZE_MAX || this->order->ids.empty()) {
+        this->showImage();
+        return true;
+    }
+
+    // the selected image keeps its place on screen, only its position in the order changes as hues arrive
+    this->imageIndex = this->positionOf(this->gridView ? selectedId : this->shownId, this->imageIndex);
+    if (!this->gridView && this->order->ids[this->imageIndex] != this->shownId)
+        this->showImage(); // the order doesn't have the shown image yet, so whatever's at its old position is shown instead of a title that doesn't match
+    else
+        this->updateTitle();
+    return true;
+}
+
+void viewer::handleKey(const sf::Keyboard::Key key) {
+    const int size = (int)this->order->ids.size();
+    if (size == 0)
+        return;
+
+    this->redraw = true;
+
+    /* "O" moves on to the next sort key; the selected image stays selected, it just moves to its place in the new order
+     * The catalog sorts every key on its own thread, so this only picks up the latest order for the key; a key with none yet (just after the first image arrives), or that no image has a value for (the perceptual hue without "--perceptual-hue"), is skipped
+     * While images are still arriving that order can be a little behind the snapshot, and if the selected image isn't in it yet the selection stays at the same position instead
+     */
+    if (key == sf::Keyboard::Key::O) {
+        size_t selectedId = this->order->ids[this->imageIndex];
+        for (int step = 1; step < SORT_KEYS; step++) {
+            sortKey next = (sortKey)(((int)this->key + step) % SORT_KEYS);
+            std::shared_ptr<const catalogSnapshot> latest;
+            std::shared_ptr<const catalogOrder> nextOrder = this->cat->orderBy(next, &latest);
+            if (nextOrder == nullptr || nextOrder->ids.empty() || nextOrder->sortedCount == 0)
+                continue;
+
+            this->key = next;
+            this->snapshot = latest;
+            this->order = nextOrder;
+            this->imageIndex = this->positionOf(selectedId, this->imageIndex);
+            this->gridPage = -1;
+            if (!this->gridView && this->order->ids[this->imageIndex] != this->shownId)
+                this->showImage();
+            else if (this->shownId != SIZE_MAX)
+                this->updateTitle();
+            break;
+        }
+        return;
+    }
+
+    if (key == sf::Keyboard::Key::C) {
+        this->wheelShown = !this->wheelShown;
+        return;
+    }
+
+    // "G" switches between the single image and the grid, and Enter picks the selected thumbnail
+    if (key == sf::Keyboard::Key::G) {
+        this->gridView = !this->gridView;
+        this->gridPage = -1;
+    }
+    else if (key == sf::Keyboard::Key::Enter)
+        this->gridView = false;
+
+    // adjust the image index
+    if (key == sf::Keyboard::Key::Left)
+        this->imageIndex = (this->imageIndex + size - 1) % size;
+    else if (key == sf::Keyboard::Key::Right)
+        this->imageIndex = (this->imageIndex + 1) % size;
+    else if (this->gridView && key == sf::Keyboard::Key::Up)
+        this->imageIndex = (this->imageIndex + size - GRID_COLUMNS % size) % size;
+    else if (this->gridView && key == sf::Keyboard::Key::Down)
+        this->imageIndex = (this->imageIndex + GRID_COLUMNS) % size;
+
+    if (key == sf::Keyboard::Key::Left || key == sf::Keyboard::Key::Right || key == sf::Keyboard::Key::G || key == sf::Keyboard::Key::Enter) {
+        if (!this->gridView)
+            this->showImage();
+        return;
+    }
+    if (this->gridView || this->shownId == SIZE_MAX)
+        return;
+
+    // +/- zoom, 0 goes back to fitting the window, and WASD pans by a tenth of the screen
+    if (key == sf::Keyboard::Key::Equal || key == sf::Keyboard::Key::Add)
+        this->zoom = std::min(this->maxZoom(), this->zoom * 1.5f);
+    else if (key == sf::Keyboard::Key::Dash || key == sf::Keyboard::Key::Subtract)
+        this->zoom = std::max(1.f, this->zoom / 1.5f);
+    else if (key == sf::Keyboard::Key::Num0 || key == sf::Keyboard::Key::Numpad0)
+        this->zoom = 1.f;
+    else if (key == sf::Keyboard::Key::A)
+        this->zoomCentre.x -= 0.1f / this->zoom;
+    else if (key == sf::Keyboard::Key::D)
+        this->zoomCentre.x += 0.1f / this->zoom;
+    else if (key == sf::Keyboard::Key::W)
+        this->zoomCentre.y -= 0.1f / this->zoom;
+    else if (key == sf::Keyboard::Key::S)
+        this->zoomCentre.y += 0.1f / this->zoom;
+
+    this->zoomCentre.x = std::max(0.f, std::min(1.f, this->zoomCentre.x));
+    this->zoomCentre.y = std::max(0.f, std::min(1.f, this->zoomCentre.y));
+
+    if (this->zoom > 1.f && this->pyramid == nullptr)
+        this->requestPyramid();
+}
+
+// where image "id" is in "order", or "fallback" (kept inside the order) if the order doesn't have it yet
+int viewer::positionOf(const size_t id, const int fallback) const {
+    if (id < this->order->positions.size())
+        return (int)this->order->positions[id];
+    return std::max(0, std::min(fallback, (int)this->order->ids.size() - 1));
+}
+
+/* Moves to "hue" in the hue order, switching to it if another key was being used, as a hue means nothing in e.g. date order
+ * The start of the hues near it is used rather than the single nearest, so a click on teal lands at the beginning of the teals
+ */
+void viewer::jumpToHue(const double hue) {
+    this->key = sortKey::hue;
+    this->order = this->snapshot->byHue;
+
+    std::vector<positionRange> near = hueRange(*this->order, hue - WHEEL_SNAP, hue + WHEEL_SNAP);
+    size_t position = near.empty() ? nearestHue(*this->order, hue) : near.front().first;
+    if (position == SIZE_MAX)
+        return;
+
+    this->imageIndex = (int)position;
+    this->gridPage = -1;
+    if (!this->gridView)
+        this->showImage();
+    else
+        this->updateTitle();
+}
+
+// true if the click was on the colour wheel, "x" and "y" are in the viewer's coordinates rather than the window's
+bool viewer::handleClick(const float x, const float y) {
+    if (!this->wheelShown || this->snapshot->entries.empty())
+        return false;
+
+    sf::Vector2f offset = sf::Vector2f(x, y) - this->wheelCentre();
+    float distance = std::sqrt(offset.x * offset.x + offset.y * offset.y);
+    if (distance < WHEEL_INNER || distance > WHEEL_OUTER)
+        return false;
+
+    double hue = std::atan2(-offset.y, offset.x) / RADIANS_PER_DEGREE;
+    this->jumpToHue(hue < 0 ? hue + 360.0 : hue);
+    this->redraw = true;
+    return true;
+}
+
+void viewer::handleScroll(const float delta) {
+    if (delta > 0)
+        this->handleKey(sf::Keyboard::Key::Equal);
+    else if (delta < 0)
+        this->handleKey(sf::Keyboard::Key::Dash);
+}
+
+void viewer::resetZoom() {
+    this->zoom = 1.f;
+    this->zoomCentre = { 0.5f, 0.5f };
+    this->pyramid = nullptr;
+    this->cancelPyramid();
+    this->tileOrder.clear();
+    this->tileCache.clear();
+}
+
+void viewer::requestPyramid() {
+    if (this->pyramidLoad != nullptr && this->pyramidLoad->id == this->shownId)
+        return;
+
+    this->cancelPyramid();
+    std::shared_ptr<pyramidRequest> request = std::make_shared<pyramidRequest>();
+    request->id = this->shownId;
+    request->path = this->snapshot->entries[this->shownId]->path;
+    request->done = false;
+    request->cancelled = false;
+    this->pyramidLoad = request;
+
+    {
+        std::lock_guard<std::mutex> lock(pyramidMutex);
+        this->pyramidPending = request;
+        if (!this->pyramidWorker.joinable())
+            this->pyramidWorker = std::thread(&viewer::buildPyramids, this);
+    }
+    this->pyramidWanted.notify_one();
+}
+
+// drops the shown image's request; if the worker hasn't taken it yet it never will, and if it's being built it stops at the next band and frees what it had
+void viewer::cancelPyramid() {
+    if (this->pyramidLoad == nullptr)
+        return;
+
+    this->pyramidLoad->cancelled = true;
+    this->pyramidLoad = nullptr;
+    std::lock_guard<std::mutex> lock(pyramidMutex);
+    this->pyramidPending = nullptr;
+}
+
+// the "pyramidWorker" thread: builds the latest request, then waits for another
+void viewer::buildPyramids() {
+    std::unique_lock<std::mutex> lock(pyramidMutex);
+    while (true) {
+        this->pyramidWanted.wait(lock, [this]() { return this->pyramidStopping || this->pyramidPending != nullptr; });
+        if (this->pyramidStopping)
+            return;
+
+        std::shared_ptr<pyramidRequest> request = std::move(this->pyramidPending);
+        this->pyramidPending = nullptr;
+        lock.unlock();
+
+        if (!request->cancelled)
+            request->result = tiledPyramid::fromFile(request->path, this->budget, request->cancelled);
+        request->done = true;
+
+        lock.lock();
+    }
+}
+
+// the closest zoom allows 8 screen pixels per image pixel, and until the image's real size is known it's capped at 64x
+float viewer::maxZoom() const {
+    if (this->pyramid == nullptr)
+        return 64.f;
+
+    float fit = std::min(WIDTH / (float)this->pyramid->getWidth(0), HEIGHT / (float)this->pyramid->getHeight(0));
+    return std::max(1.f, 8.f / fit);
+}
+
+const sf::Texture& viewer::tileTexture(const int lvl, const unsigned int column, const unsigned int row) {
+    uint64_t key = ((uint64_t)lvl << 56) | ((uint64_t)row << 28) | column;
+
+    auto cached = this->tileCache.find(key);
+    if (cached != this->tileCache.end()) {
+        this->tileOrder.splice(this->tileOrder.end(), this->tileOrder, cached->second.second);
+        return cached->second.first;
+    }
+
+    if (this->tileCache.size() >= TILE_CACHE_SIZE) {
+        this->tileCache.erase(this->tileOrder.front());
+        this->tileOrder.pop_front();
+    }
+
+    // the tiles are in the file's own channels, and a texture wants RGBA
+    const bitmap& tile = this->pyramid->getTile(lvl, column, row);
+    const unsigned int channels = this->pyramid->getChannels();
+    std::vector<uint8_t> rgba;
+    if (channels != 4) {
+        rgba.resize((size_t)tile.width * tile.height * 4);
+        for (size_t i = 0; i < (size_t)tile.width * tile.height; i++) {
+            const uint8_t* from = &tile.pixels[i * channels];
+            rgba[i * 4] = from[0];
+            rgba[i * 4 + 1] = channels >= 3 ? from[1] : from[0];
+            rgba[i * 4 + 2] = channels >= 3 ? from[2] : from[0];
+            rgba[i * 4 + 3] = channels == 2 ? from[1] : 255;
+        }
+    }
+
+    auto& inserted = this->tileCache[key];
+    inserted.first.create(tile.width, tile.height);
+    inserted.first.update(channels == 4 ? tile.pixels.data() : rgba.data());
+    inserted.first.setSmooth(true);
+    inserted.second = this->tileOrder.insert(this->tileOrder.end(), key);
+    return inserted.first;
+}
+
+void viewer::drawZoomed(sf::RenderTarget& target) {
+    if (this->pyramid == nullptr) {
+        // blurry, but it means zooming responds immediately while the pyramid is built
+        sf::Sprite stretched = this->sprite;
+        sf::Vector2u size = stretched.getTexture()->getSize();
+        float scale = std::min(WIDTH / (float)size.x, HEIGHT / (float)size.y) * this->zoom;
+        stretched.setScale(scale, scale);
+        stretched.setPosition(WIDTH / 2.f - this->zoomCentre.x * size.x * scale, HEIGHT / 2.f - this->zoomCentre.y * size.y * scale);
+        target.draw(stretched);
+        return;
+    }
+
+    const float width = (float)this->pyramid->getWidth(0), height = (float)this->pyramid->getHeight(0);
+    const float scale = std::min(WIDTH / width, HEIGHT / height) * this->zoom; // screen pixels per full resolution pixel
+
+    // the smallest level that still has at least one pixel per screen pixel
+    int lvl = (int)std::floor(std::log2(1.f / scale));
+    lvl = std::max(0, std::min(this->pyramid->levelCount() - 1, lvl));
+    const float levelScale = (float)(1 << lvl); // full resolution pixels per level pixel
+    const float tileSpan = PYRAMID_TILE_SIZE * levelScale; // full resolution pixels per tile
+
+    // the part of the image on screen, in full resolution pixels
+    const float left = this->zoomCentre.x * width - WIDTH / 2.f / scale;
+    const float top = this->zoomCentre.y * height - HEIGHT / 2.f / scale;
+
+    int firstColumn = std::max(0, (int)std::floor(left / tileSpan));
+    int lastColumn = std::min((int)this->pyramid->getColumns(lvl) - 1, (int)std::floor((left + WIDTH / scale) / tileSpan));
+    int firstRow = std::max(0, (int)std::floor(top / tileSpan));
+    int lastRow = std::min((int)this->pyramid->getRows(lvl) - 1, (int)std::floor((top + HEIGHT / scale) / tileSpan));
+
+    for (int row = firstRow; row <= lastRow; row++)
+        for (int column = firstColumn; column <= lastColumn; column++) {
+            sf::Sprite tile(this->tileTexture(lvl, column, row));
+            tile.setScale(levelScale * scale, levelScale * scale);
+            tile.setPosition((column * tileSpan - left) * scale, (row * tileSpan - top) * scale);
+            target.draw(tile);
+        }
+}
+
+void viewer::draw(sf::RenderTarget& target) {
+    const int gridPageSize = GRID_COLUMNS * GRID_ROWS;
+
+    if (this->gridView && this->imageIndex / gridPageSize != this->gridPage)
+        this->buildGridPage();
+
+    this->redraw = false;
+
+    // Clear the window
+    target.clear(sf::Color(0, 0, 0));
+    if (this->gridView) {
+        // draw the page of thumbnails and outline the selected one
+        for (sf::Sprite& s : this->gridSprites)
+            target.draw(s);
+        int cell = this->imageIndex % gridPageSize;
+        this->gridSelection.setPosition((cell % GRID_COLUMNS) * THUMBNAIL_WIDTH + 1.f, (cell / GRID_COLUMNS) * THUMBNAIL_HEIGHT + 1.f);
+        target.draw(this->gridSelection);
+    }
+    else if (this->zoom > 1.f)
+        this->drawZoomed(target);
+    else
+        // draw the sprite
+        target.draw(this->sprite);
+
+    if (this->wheelShown) {
+        target.draw(this->wheel);
+        if (this->imageIndex < (int)this->order->ids.size() && this->entryAt(this->imageIndex).hueKnown) {
+            const catalogEntry& selected = this->entryAt(this->imageIndex);
+            float angle = (float)(selected.medianHue * RADIANS_PER_DEGREE);
+            float radius = (WHEEL_OUTER + WHEEL_INNER) / 2.f;
+            this->wheelMarker.setPosition(this->wheelCentre() + sf::Vector2f(std::cos(angle), -std::sin(angle)) * radius);
+            target.draw(this->wheelMarker);
+        }
+    }
+}
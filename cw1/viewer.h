@@ -0,0 +1,129 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <SFML/Graphics.hpp>
+#include "budget.h"
+#include "catalog.h"
+#include "pyramid.h"
+#include "thumbnails.h"
+
+sf::Vector2f ScaleFromDimensions(const sf::Vector2u& textureSize, int screenWidth, int screenHeight);
+
+/* The viewer's state and drawing, kept apart from the window so it can be driven by "UIThread" or by the UI benchmark
+ * It browses whichever catalog snapshot it picked up last, and draws to any "sf::RenderTarget" (the window, or an offscreen "sf::RenderTexture")
+ */
+class viewer
+{
+private:
+	std::shared_ptr<catalog> cat;
+	std::shared_ptr<thumbnailStore> store;
+	std::shared_ptr<memoryBudget> budget; // shared with the loading threads, a zoomed image's pyramid is reserved from it
+
+	/* "imageIndex" is a position in "order", the snapshot's images sorted by "key"
+	 * When a newer snapshot is picked up, or "O" switches to another key, the selected image is found again by its id, as sorting may have moved it
+	 * Other than the hue order, "order" may have been sorted from an older snapshot and be missing its newest images, so it's what's browsed rather than all of "snapshot"
+	 */
+	std::shared_ptr<const catalogSnapshot> snapshot;
+	std::shared_ptr<const catalogOrder> order;
+	sortKey key = sortKey::hue;
+	int imageIndex = 0;
+	size_t shownId = SIZE_MAX; // SIZE_MAX while the placeholder is shown
+
+	// the grid view shows a page of thumbnails around "imageIndex", its textures are only rebuilt when the page changes
+	bool gridView = false;
+	int gridPage = -1;
+	std::vector<sf::Texture> gridTextures;
+	std::vector<sf::Sprite> gridSprites;
+	sf::RectangleShape gridSelection;
+
+	/* "C" shows a colour wheel in the corner; clicking it jumps to the first image in the hue order within WHEEL_SNAP degrees of where was clicked, or the nearest one if there are none
+	 * Both are binary searches in the hue order's values, so this stays instant however many images there are
+	 */
+	static const int WHEEL_OUTER = 60;
+	static const int WHEEL_INNER = 36;
+	static constexpr double WHEEL_SNAP = 7.5;
+	bool wheelShown = false;
+	sf::VertexArray wheel;
+	sf::CircleShape wheelMarker; // the shown image's hue
+
+	sf::Texture texture;
+	sf::Texture placeholder;
+	sf::Sprite sprite;
+	std::string title = "Image Fever";
+
+	/* Frames are only drawn when something has changed (input, a resize, a new catalog snapshot)
+	 * Anything animated would keep "redraw" set for as long as it runs, so the main loop draws every frame until it's done
+	 */
+	bool redraw = true;
+
+	/* Zoom 1 is the whole image fitted to the window; above that the image is drawn from its pyramid's tiles around "zoomCentre" (a fraction of the image's width and height)
+	 * The pyramid is built the first time an image is zoomed into, until then (or while the budget has no room for one) the preview is stretched so zooming still responds straight away
+	 * Builds are done one at a time by "pyramidWorker"; a new request replaces one that hasn't started, and cancels the one being built, so paging through zoomed images never stacks up decodes
+	 */
+	typedef struct {
+		size_t id;
+		std::string path;
+		std::atomic<bool> done;
+		std::atomic<bool> cancelled; // set once the viewer has moved on, the build stops at its next band
+		std::shared_ptr<tiledPyramid> result;
+	} pyramidRequest;
+
+	float zoom = 1.f;
+	sf::Vector2f zoomCentre = { 0.5f, 0.5f };
+	std::shared_ptr<pyramidRequest> pyramidLoad; // the request for the shown image, whether it's waiting or being built
+	std::shared_ptr<tiledPyramid> pyramid; // the shown image's, once it's built
+
+	std::thread pyramidWorker; // started by the first request, and joined by the destructor
+	std::mutex pyramidMutex;
+	std::condition_variable pyramidWanted;
+	std::shared_ptr<pyramidRequest> pyramidPending; // the next request for the worker to take
+	bool pyramidStopping = false;
+
+	// uploaded tiles keyed by level/column/row, the least recently drawn are deleted once there are more than TILE_CACHE_SIZE so texture memory stays bounded
+	static const size_t TILE_CACHE_SIZE = 96;
+	std::list<uint64_t> tileOrder;
+	std::unordered_map<uint64_t, std::pair<sf::Texture, std::list<uint64_t>::iterator>> tileCache;
+
+	[[nodiscard]] const catalogEntry& entryAt(int index) const { return *snapshot->entries[order->ids[index]]; }
+	void updateTitle();
+	void buildWheel();
+	[[nodiscard]] sf::Vector2f wheelCentre() const { return { WIDTH - WHEEL_OUTER - 10.f, HEIGHT - WHEEL_OUTER - 10.f }; }
+	[[nodiscard]] int positionOf(size_t id, int fallback) const;
+	void jumpToHue(double hue);
+	void showImage();
+	void buildGridPage();
+	void resetZoom();
+	void requestPyramid();
+	void cancelPyramid();
+	void buildPyramids();
+	[[nodiscard]] float maxZoom() const;
+	const sf::Texture& tileTexture(int lvl, unsigned int column, unsigned int row);
+	void drawZoomed(sf::RenderTarget& target);
+public:
+	static const int WIDTH = 800;
+	static const int HEIGHT = 600;
+	static const int GRID_COLUMNS = WIDTH / THUMBNAIL_WIDTH;
+	static const int GRID_ROWS = HEIGHT / THUMBNAIL_HEIGHT;
+
+	viewer(std::shared_ptr<catalog> _cat, std::shared_ptr<thumbnailStore> _store, std::shared_ptr<memoryBudget> _budget, const std::string& placeholderPath);
+	~viewer();
+	viewer(const viewer&) = delete;
+	viewer& operator=(const viewer&) = delete;
+	bool refresh();
+	void handleKey(sf::Keyboard::Key key);
+	void handleScroll(float delta);
+	bool handleClick(float x, float y);
+	void invalidate() { redraw = true; }
+	[[nodiscard]] bool needsRedraw() const { return redraw; }
+	[[nodiscard]] bool isShowingImage() const { return shownId != SIZE_MAX; }
+	[[nodiscard]] uint64_t getSnapshotVersion() const { return snapshot->version; }
+	[[nodiscard]] const std::string& getTitle() const { return title; }
+	void draw(sf::RenderTarget& target);
+};